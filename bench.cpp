@@ -0,0 +1,337 @@
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <time.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "clinic.h"
+#include "event_log.h"
+#include "shards.h"
+
+// Benchmark sweep: runs the clinic engine in-process over a grid of (doctors, nurses, patients)
+// with repeated trials, and writes one CSV row per trial
+
+// ----- Utils
+
+// "1,2,4" -> {1, 2, 4}. Empty on anything that is not a list of positive numbers
+std::vector<int> parseList(const char *text)
+{
+    std::vector<int> values;
+    const char *cursor = text;
+
+    while (*cursor != '\0')
+    {
+        char *end;
+        long value = strtol(cursor, &end, 10);
+        if (end == cursor || value < 1 || (*end != ',' && *end != '\0'))
+            return std::vector<int>();
+
+        values.push_back((int)value);
+        cursor = *end == ',' ? end + 1 : end;
+    }
+
+    return values;
+}
+
+// Peak resident set size in KiB since the last resetPeakRss
+long peakRssKb()
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL)
+        return -1;
+
+    char line[256];
+    long peak = -1;
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (sscanf(line, "VmHWM: %ld kB", &peak) == 1)
+            break;
+    }
+
+    fclose(status);
+    return peak;
+}
+
+// getrusage's maxrss only ever grows in one process, so reset the kernel's high-water mark between trials
+void resetPeakRss()
+{
+    FILE *clearRefs = fopen("/proc/self/clear_refs", "w");
+    if (clearRefs == NULL)
+        return;
+
+    fputs("5", clearRefs);
+    fclose(clearRefs);
+}
+
+// ----- Sweep
+
+struct Trial
+{
+    double wallTime;
+    double userTime;
+    double sysTime;
+    long voluntarySwitches;
+    long involuntarySwitches;
+    long peakRss;
+    double endToEndP50; // Seconds from entering to leaving, half the patients took less
+    double endToEndP99;
+};
+
+// numShards clinics behind the front door when more than one, patients split between them
+Trial runTrial(const ClinicConfig &config, int numShards, RoutePolicy route)
+{
+    resetPeakRss();
+
+    rusage before, after;
+    processUsage(before);
+    double start = monotonicSeconds();
+
+    Trial trial;
+    if (numShards > 1)
+    {
+        ShardedClinic *sharded = createShardedClinic(config, numShards, route);
+        runShardedClinic(*sharded);
+
+        trial.endToEndP50 = sharded->endToEnd.percentile(0.50) / 1e9;
+        trial.endToEndP99 = sharded->endToEnd.percentile(0.99) / 1e9;
+        destroyShardedClinic(sharded);
+    }
+    else
+    {
+        Clinic *clinic = createClinic(config);
+        runClinic(*clinic);
+
+        trial.endToEndP50 = clinic->phaseLatency[PHASE_END_TO_END].percentile(0.50) / 1e9;
+        trial.endToEndP99 = clinic->phaseLatency[PHASE_END_TO_END].percentile(0.99) / 1e9;
+        destroyClinic(clinic);
+    }
+
+    double end = monotonicSeconds();
+    processUsage(after);
+
+    trial.wallTime = end - start;
+    trial.userTime = timevalSeconds(after.ru_utime) - timevalSeconds(before.ru_utime);
+    trial.sysTime = timevalSeconds(after.ru_stime) - timevalSeconds(before.ru_stime);
+    trial.voluntarySwitches = after.ru_nvcsw - before.ru_nvcsw;
+    trial.involuntarySwitches = after.ru_nivcsw - before.ru_nivcsw;
+    trial.peakRss = peakRssKb();
+    return trial;
+}
+
+// ----- Main
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--doctors LIST] [--nurses LIST] [--patients LIST] [--trials N] [--workers N] [--receptionists N]\n"
+                    "       [--engine threads|coroutines|simulation] [--sync semaphore|spin] [--seed N] [--out FILE]\n"
+                    "       [--admission-batch LIST] [--admission-timeout SECONDS] [--placement none|paired|isolated|spread]\n"
+                    "       [--processes] [--shards LIST] [--route round-robin|least-loaded|two-choices]\n"
+                    "       LIST is comma separated, e.g. 1,2,4\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<int> doctorCounts = parseList("1,2,4,8");
+    std::vector<int> nurseCounts = parseList("1,2,4,8");
+    std::vector<int> patientCounts = parseList("1000,10000,50000");
+    std::vector<int> batchSizes = parseList("1");
+    std::vector<int> shardCounts = parseList("1");
+    RoutePolicy route = ROUTE_ROUND_ROBIN;
+    double admissionTimeout = 1e-3;
+    int trials = 3;
+    int numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    int numReceptionists = 1;
+    ClinicEngine engine = ENGINE_THREADS;
+    SyncPrimitive sync = SYNC_SEMAPHORE;
+    Placement placement = PLACE_NONE;
+    bool processes = false;
+    uint64_t seed = 1; // Fixed, so repeated sweeps make the same random choices
+    const char *outPath = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+
+        if (option == "--doctors" && i + 1 < argc)
+            doctorCounts = parseList(argv[++i]);
+        else if (option == "--nurses" && i + 1 < argc)
+            nurseCounts = parseList(argv[++i]);
+        else if (option == "--patients" && i + 1 < argc)
+            patientCounts = parseList(argv[++i]);
+        else if (option == "--processes")
+            processes = true;
+        else if (option == "--shards" && i + 1 < argc)
+            shardCounts = parseList(argv[++i]);
+        else if (option == "--route" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+
+            if (name == "round-robin")
+                route = ROUTE_ROUND_ROBIN;
+            else if (name == "least-loaded")
+                route = ROUTE_LEAST_LOADED;
+            else if (name == "two-choices")
+                route = ROUTE_TWO_CHOICES;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--placement" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+
+            if (name == "none")
+                placement = PLACE_NONE;
+            else if (name == "paired")
+                placement = PLACE_PAIRED;
+            else if (name == "isolated")
+                placement = PLACE_ISOLATED;
+            else if (name == "spread")
+                placement = PLACE_SPREAD;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--admission-batch" && i + 1 < argc)
+            batchSizes = parseList(argv[++i]);
+        else if (option == "--admission-timeout" && i + 1 < argc)
+            admissionTimeout = atof(argv[++i]);
+        else if (option == "--trials" && i + 1 < argc)
+            trials = atoi(argv[++i]);
+        else if (option == "--workers" && i + 1 < argc)
+            numWorkers = atoi(argv[++i]);
+        else if (option == "--receptionists" && i + 1 < argc)
+            numReceptionists = atoi(argv[++i]);
+        else if (option == "--engine" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+
+            if (name == "threads")
+                engine = ENGINE_THREADS;
+            else if (name == "coroutines")
+                engine = ENGINE_COROUTINES;
+            else if (name == "simulation")
+                engine = ENGINE_SIMULATION;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--sync" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+
+            if (name == "semaphore")
+                sync = SYNC_SEMAPHORE;
+            else if (name == "spin")
+                sync = SYNC_SPIN;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--seed" && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10);
+        else if (option == "--out" && i + 1 < argc)
+            outPath = argv[++i];
+        else
+            usage(argv[0]);
+    }
+
+    if (doctorCounts.empty() || nurseCounts.empty() || patientCounts.empty() || batchSizes.empty() || shardCounts.empty() || trials < 1 || numWorkers < 1 ||
+        numReceptionists < 1 || admissionTimeout < 0)
+    {
+        usage(argv[0]);
+    }
+
+    FILE *out = stdout;
+    if (outPath != NULL)
+    {
+        out = fopen(outPath, "w");
+        if (out == NULL)
+        {
+            perror(outPath);
+            exit(1);
+        }
+    }
+
+    // Event output would only measure the terminal
+    logStart(LOG_SILENT, NULL);
+
+    fprintf(out, "engine,doctors,nurses,patients,workers,receptionists,admission_batch,placement,processes,shards,route,trial,wall_s,patients_per_s,user_s,sys_s,voluntary_switches,involuntary_switches,peak_rss_kb,end_to_end_p50_s,end_to_end_p99_s\n");
+
+    for (int numDoctors : doctorCounts)
+    {
+        for (int numNurses : nurseCounts)
+        {
+            for (int numPatients : patientCounts)
+            {
+                for (int admissionBatch : batchSizes)
+                {
+                    ClinicConfig config;
+                    config.numDoctors = numDoctors;
+                    config.numNurses = numNurses;
+                    config.numPatients = numPatients;
+                    config.numWorkers = numWorkers;
+                    config.numReceptionists = numReceptionists;
+                    config.assignPolicy = ASSIGN_RANDOM;
+                    config.steal = false;
+                    config.roomCapacity = 0;
+                    config.overflow = OVERFLOW_BLOCK;
+                    config.admissionBatch = admissionBatch;
+                    config.admissionTimeout = admissionTimeout;
+                    config.dispatchPolicy = DISPATCH_SHARED;
+                    config.placement = placement;
+                    config.processes = processes && engine == ENGINE_THREADS;
+                    config.engine = engine;
+                    config.arrivals = ARRIVAL_BATCH;
+                    config.arrivalRate = 0;
+                    config.arrivalTrace = NULL;
+                    config.receptionService = {SERVICE_FIXED, 0, 0};
+                    config.nurseService = {SERVICE_FIXED, 0, 0};
+                    config.doctorService = {SERVICE_FIXED, 0, 0};
+                    config.timing = TIMING_HYBRID;
+                    config.sync = sync;
+                    config.triageShare[PRIORITY_URGENT] = 0;
+                    config.triageShare[PRIORITY_STANDARD] = 100;
+                    config.triageShare[PRIORITY_LOW] = 0;
+                    config.triageWeights[PRIORITY_URGENT] = 8;
+                    config.triageWeights[PRIORITY_STANDARD] = 3;
+                    config.triageWeights[PRIORITY_LOW] = 1;
+                    config.seed = seed;
+
+                    for (int numShards : shardCounts)
+                    {
+                        // Shards are thread-engine clinics in this process, like staff processes only with threads
+                        int shards = engine == ENGINE_THREADS && !config.processes ? numShards : 1;
+
+                        double wallTotal = 0;
+                        for (int trial = 0; trial < trials; trial++)
+                        {
+                            Trial result = runTrial(config, shards, route);
+                            wallTotal += result.wallTime;
+
+                            fprintf(out, "%s,%d,%d,%d,%d,%d,%d,%s,%d,%d,%s,%d,%.6f,%.1f,%.6f,%.6f,%ld,%ld,%ld,%.6f,%.6f\n",
+                                    engineNames[engine], numDoctors, numNurses, numPatients, numWorkers, numReceptionists, admissionBatch,
+                                    placementNames[placement], config.processes, shards, routeNames[route], trial,
+                                    result.wallTime, numPatients / result.wallTime, result.userTime, result.sysTime,
+                                    result.voluntarySwitches, result.involuntarySwitches, result.peakRss,
+                                    result.endToEndP50, result.endToEndP99);
+                            fflush(out);
+                        }
+
+                        // Progress on stderr so it never mixes into the CSV
+                        fprintf(stderr, "%d doctors, %d nurses, %d patients, admission batch %d, placement %s, %d shards: %.0f patients/s\n",
+                                numDoctors, numNurses, numPatients, admissionBatch, placementNames[placement], shards,
+                                numPatients * trials / wallTotal);
+                    }
+                }
+            }
+        }
+    }
+
+    logStop();
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
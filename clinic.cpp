@@ -0,0 +1,1769 @@
+#include <cstring>
+#include <new>
+#include <cstdlib>
+#include <cmath>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "clinic.h"
+#include "event_log.h"
+#include "sem_stats.h"
+
+#define errexit(code, str)                              \
+    fprintf(stderr, "%s: %s\n", (str), strerror(code)); \
+    exit(1);
+
+// ----- Utils
+
+uint64_t randomStream(RandomStream kind, int id)
+{
+    return ((uint64_t)kind << 32) | (uint32_t)id;
+}
+
+int randomNurse(const ClinicConfig &config, int patientId)
+{
+    Xoshiro256 random;
+    random.seed(config.seed, randomStream(STREAM_PATIENT, patientId));
+    return random.inRange(0, config.numNurses - 1);
+}
+
+double timespecSeconds(const timespec &ts)
+{
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double monotonicSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespecSeconds(ts);
+}
+
+double timevalSeconds(const timeval &tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void processUsage(rusage &usage)
+{
+    rusage children;
+    getrusage(RUSAGE_SELF, &usage);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    timeradd(&usage.ru_utime, &children.ru_utime, &usage.ru_utime);
+    timeradd(&usage.ru_stime, &children.ru_stime, &usage.ru_stime);
+    usage.ru_nvcsw += children.ru_nvcsw;
+    usage.ru_nivcsw += children.ru_nivcsw;
+}
+
+Priority randomPriority(const ClinicConfig &config, int patientId)
+{
+    Xoshiro256 random;
+    random.seed(config.seed, randomStream(STREAM_TRIAGE, patientId));
+    int percent = random.inRange(0, 99);
+
+    for (int priority = 0; priority < PRIORITY_COUNT - 1; priority++)
+    {
+        if (percent < config.triageShare[priority])
+            return (Priority)priority;
+        percent -= config.triageShare[priority];
+    }
+
+    return (Priority)(PRIORITY_COUNT - 1);
+}
+
+double sampleService(const ServiceTime &service, Xoshiro256 &random)
+{
+    switch (service.distribution)
+    {
+    case SERVICE_EXPONENTIAL:
+        // 1 - uniform is in (0, 1], so the log stays finite
+        return -service.mean * log(1 - random.uniform());
+
+    case SERVICE_LOGNORMAL:
+    {
+        // One standard normal by Box-Muller, shifted so the mean is service.mean rather than the median
+        double normal = sqrt(-2 * log(1 - random.uniform())) * cos(2 * M_PI * random.uniform());
+        return service.mean * exp(service.sigma * normal - service.sigma * service.sigma / 2);
+    }
+
+    default:
+        return service.mean;
+    }
+}
+
+double nextArrival(const ClinicConfig &config, Xoshiro256 &random, int patientId, double previous)
+{
+    switch (config.arrivals)
+    {
+    case ARRIVAL_POISSON:
+        return previous - log(1 - random.uniform()) / config.arrivalRate;
+
+    case ARRIVAL_TRACE:
+        return config.arrivalTrace[patientId];
+
+    default:
+        return 0;
+    }
+}
+
+void waitUntil(Clinic &clinic, double deadline)
+{
+    // The default timer slack lets the kernel wake a sleeper up to 50 us late. Drop it once per thread
+    static thread_local bool slackDropped = false;
+    if (!slackDropped)
+    {
+        prctl(PR_SET_TIMERSLACK, 1);
+        slackDropped = true;
+    }
+
+    ServiceTiming timing = clinic.config.timing;
+    double wakeAt = timing == TIMING_HYBRID ? deadline - SPIN_MARGIN : deadline;
+
+    if (timing != TIMING_SPIN)
+    {
+        timespec ts;
+        ts.tv_sec = (time_t)wakeAt;
+        ts.tv_nsec = (long)((wakeAt - ts.tv_sec) * 1e9);
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+    }
+
+    double now = monotonicSeconds();
+    if (timing != TIMING_SLEEP)
+    {
+        while (now < deadline)
+            now = monotonicSeconds();
+    }
+
+    clinic.timerLateness.record(now > deadline ? (uint64_t)((now - deadline) * 1e9) : 0);
+}
+
+// Count one blocked wait that started at blockedSince
+void countBlocked(SemStats &stats, double blockedSince)
+{
+    double asleep = monotonicSeconds() - blockedSince;
+    stats.blocked++;
+    stats.blockedTotal += asleep;
+    if (asleep > stats.blockedMax)
+        stats.blockedMax = asleep;
+}
+
+// Try first, so only a wait that really sleeps pays for reading the clock. A spinning semaphore polls
+// before it sleeps, and learns from how long the sleep turned out to be
+void semWait(SpinSemaphore &sem, const char *name)
+{
+    SemStats &stats = semStats(name);
+    stats.waits++;
+
+    if (sem.tryWait() == 0)
+        return;
+
+    if (sem.spins() && sem.spinWait())
+    {
+        stats.spun++;
+        return;
+    }
+
+    double blockedSince = monotonicSeconds();
+    while (sem.park() == -1)
+    {
+        if (errno != EINTR)
+        {
+            printf("Wait on semaphore %s\n", name);
+            exit(1);
+        }
+    }
+    countBlocked(stats, blockedSince);
+
+    if (sem.spins())
+        sem.parked(monotonicSeconds() - blockedSince);
+}
+
+void semPost(SpinSemaphore &sem, const char *name)
+{
+    semStats(name).posts++;
+
+    if (sem.post() == -1)
+    {
+        printf("Post semaphore %s\n", name);
+        exit(1);
+    }
+}
+
+// False when the semaphore is zero. Only a successful try counts as a wait
+bool semTryWait(SpinSemaphore &sem, const char *name)
+{
+    if (sem.tryWait() == 0)
+    {
+        semStats(name).waits++;
+        return true;
+    }
+
+    if (errno != EAGAIN)
+    {
+        printf("Try wait on semaphore %s\n", name);
+        exit(1);
+    }
+
+    return false;
+}
+
+// False when nanoseconds pass without a post. Counted as a blocked wait either way
+bool semTimedWait(SpinSemaphore &sem, const char *name, long nanoseconds)
+{
+    SemStats &stats = semStats(name);
+    stats.waits++;
+    double blockedSince = monotonicSeconds();
+
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += nanoseconds;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+
+    while (sem.timedWait(deadline) == -1)
+    {
+        if (errno == ETIMEDOUT)
+        {
+            countBlocked(stats, blockedSince);
+            return false;
+        }
+
+        if (errno != EINTR)
+        {
+            printf("Timed wait on semaphore %s\n", name);
+            exit(1);
+        }
+    }
+
+    countBlocked(stats, blockedSince);
+    return true;
+}
+
+void semInit(SpinSemaphore &sem, const char *name, int value, const ClinicConfig &config)
+{
+    /* Initialize semaphore to 0 (3rd parameter) */
+    if (sem.init(value, config.sync == SYNC_SPIN, config.processes) == -1)
+    {
+        printf("Init semaphore %s\n", name);
+        exit(1);
+    }
+}
+
+// ----- Clinic state
+
+// Round up to a multiple of align (power of two)
+size_t alignUp(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+void *arenaAlloc(Arena &arena, size_t bytes, size_t align = CACHE_LINE)
+{
+    size_t offset = alignUp(arena.used, align);
+    arena.used = offset + bytes;
+
+    if (arena.base == NULL)
+        return NULL;
+
+    if (arena.used > arena.size)
+    {
+        fprintf(stderr, "Clinic arena overflow\n");
+        exit(1);
+    }
+
+    return arena.base + offset;
+}
+
+template <typename T>
+T *arenaArray(Arena &arena, int count)
+{
+    return (T *)arenaAlloc(arena, sizeof(T) * count, alignof(T) > CACHE_LINE ? alignof(T) : CACHE_LINE);
+}
+
+// Smallest power of two >= value
+unsigned nextPowerOfTwo(unsigned value)
+{
+    unsigned power = 1;
+    while (power < value)
+        power <<= 1;
+    return power;
+}
+
+// Capacity of an MpmcRing for up to items entries. With a single cell a full ring looks free to the next producer, so never fewer than two
+unsigned mpmcCapacity(unsigned items)
+{
+    return items < 2 ? 2 : nextPowerOfTwo(items);
+}
+
+const char *engineNames[] = {"threads", "coroutines", "simulation"};
+
+const char *arrivalNames[] = {"batch", "poisson", "trace"};
+
+const char *timingNames[] = {"sleep", "spin", "hybrid"};
+const char *syncNames[] = {"semaphore", "spin"};
+
+const char *placementNames[] = {"none", "paired", "isolated", "spread"};
+
+const char *overflowNames[] = {"block", "divert", "reject"};
+
+const char *priorityNames[] = {"urgent", "standard", "low"};
+
+const char *phaseNames[PHASE_COUNT] = {"reception wait", "registration", "waiting room", "nurse handoff", "consultation", "end to end"};
+
+// Carve the clinic and all of its arrays out of arena. Run once to measure and once to fill
+Clinic *layoutClinic(Arena &arena, const ClinicConfig &config)
+{
+    Clinic *clinic = arenaArray<Clinic>(arena, 1);
+
+    unsigned char *patientState = arenaArray<unsigned char>(arena, config.numPatients);
+    int *nurseOfPatient = arenaArray<int>(arena, config.numPatients);
+    int *doctorOfPatient = arenaArray<int>(arena, config.numPatients);
+    double *arrivedAt = arenaArray<double>(arena, config.numPatients);
+    double *phaseStartedAt = arenaArray<double>(arena, config.numPatients);
+    unsigned char *priorityOfPatient = arenaArray<unsigned char>(arena, config.numPatients);
+
+    // Line for every patient up to a cap. Arriving patients wait on a full line
+    unsigned admissionCapacity = mpmcCapacity(config.numPatients < MAX_ADMISSION_CAPACITY ? config.numPatients : MAX_ADMISSION_CAPACITY);
+    AdmissionQueue::Cell *admissionStorage = arenaArray<AdmissionQueue::Cell>(arena, admissionCapacity);
+
+    ReceptionistState *receptionists = arenaArray<ReceptionistState>(arena, config.numReceptionists);
+    int **unannounced = arenaArray<int *>(arena, config.numReceptionists);
+    for (int receptionistId = 0; receptionistId < config.numReceptionists; receptionistId++)
+    {
+        int *counts = arenaArray<int>(arena, config.numNurses);
+        if (unannounced != NULL)
+            unannounced[receptionistId] = counts;
+    }
+
+    NurseState *nurses = arenaArray<NurseState>(arena, config.numNurses);
+
+    // Room for every patient up to a cap, split across lanes. A receptionist waits on a full lane.
+    // Any class could get every patient, but one nobody is triaged into only needs a placeholder.
+    // A room with a capacity never holds more than that, which one receptionist alone may fill
+    int roomPatients = config.numPatients < MAX_ROOM_CAPACITY ? config.numPatients : MAX_ROOM_CAPACITY;
+    unsigned laneCapacity = nextPowerOfTwo((roomPatients + config.numReceptionists - 1) / config.numReceptionists);
+    if (config.roomCapacity > 0)
+        laneCapacity = nextPowerOfTwo(config.roomCapacity < roomPatients ? config.roomCapacity : roomPatients);
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+    {
+        SpscRing<int> *lanes = arenaArray<SpscRing<int>>(arena, PRIORITY_COUNT * config.numReceptionists);
+        for (int lane = 0; lane < PRIORITY_COUNT * config.numReceptionists; lane++)
+        {
+            unsigned capacity = config.triageShare[lane / config.numReceptionists] > 0 ? laneCapacity : 1;
+            int *laneStorage = arenaArray<int>(arena, capacity);
+            if (lanes != NULL)
+            {
+                new (&lanes[lane]) SpscRing<int>();
+                lanes[lane].init(laneStorage, capacity);
+            }
+        }
+
+        if (nurses != NULL)
+        {
+            new (&nurses[nurseId]) NurseState();
+            nurses[nurseId].room.lanes = lanes;
+            nurses[nurseId].room.numLanes = config.numReceptionists;
+            for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+            {
+                nurses[nurseId].room.nextLane[priority] = 0;
+                nurses[nurseId].room.triage.weights[priority] = config.triageWeights[priority];
+                nurses[nurseId].room.triage.credit[priority] = 0;
+            }
+            nurses[nurseId].room.taking.store(false);
+        }
+    }
+
+    DoctorState *doctors = arenaArray<DoctorState>(arena, config.numDoctors);
+
+    unsigned doctorPoolCapacity = mpmcCapacity(config.numDoctors);
+    DoctorPool::Cell *doctorPoolStorage = arenaArray<DoctorPool::Cell>(arena, doctorPoolCapacity);
+
+    // Each patient has at most one step queued, plus one exit marker per worker, so pushes never find it full
+    unsigned runQueueCapacity = mpmcCapacity(config.numPatients + config.numWorkers);
+    RunQueue::Cell *runQueueStorage = arenaArray<RunQueue::Cell>(arena, runQueueCapacity);
+    WorkerState *workers = arenaArray<WorkerState>(arena, config.numWorkers);
+
+    if (arena.base == NULL)
+        return NULL;
+
+    new (clinic) Clinic();
+    clinic->config = config;
+    clinic->arena = arena;
+
+    clinic->patientState = patientState;
+    clinic->nurseOfPatient = nurseOfPatient;
+    clinic->doctorOfPatient = doctorOfPatient;
+    clinic->arrivedAt = arrivedAt;
+    clinic->phaseStartedAt = phaseStartedAt;
+    clinic->priorityOfPatient = priorityOfPatient;
+
+    clinic->admission.init(admissionStorage, admissionCapacity);
+
+    clinic->receptionists = receptionists;
+    for (int receptionistId = 0; receptionistId < config.numReceptionists; receptionistId++)
+    {
+        new (&receptionists[receptionistId]) ReceptionistState();
+        receptionists[receptionistId].unannounced = unannounced[receptionistId];
+        receptionists[receptionistId].random.seed(config.seed, randomStream(STREAM_RECEPTIONIST, receptionistId));
+    }
+
+    clinic->nurses = nurses;
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+        nurses[nurseId].random.seed(config.seed, randomStream(STREAM_NURSE, nurseId));
+
+    clinic->doctors = doctors;
+    for (int doctorId = 0; doctorId < config.numDoctors; doctorId++)
+    {
+        new (&doctors[doctorId]) DoctorState();
+        doctors[doctorId].random.seed(config.seed, randomStream(STREAM_DOCTOR, doctorId));
+    }
+
+    clinic->readyDoctors.init(doctorPoolStorage, doctorPoolCapacity);
+    clinic->runQueue.init(runQueueStorage, runQueueCapacity);
+
+    clinic->workers = workers;
+    for (int workerId = 0; workerId < config.numWorkers; workerId++)
+        new (&workers[workerId]) WorkerState();
+
+    return clinic;
+}
+
+// A shared memory object for the arena, mapped before any staff process is forked so every process finds
+// it at the same address and the pointers inside stay valid. The name is unlinked straight away: nothing is
+// left behind in /dev/shm however the run ends. NULL on failure
+char *mapSharedArena(size_t size)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/clinic-%d", (int)getpid());
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1)
+    {
+        perror("shm_open");
+        return NULL;
+    }
+    shm_unlink(name);
+
+    if (ftruncate(fd, size) == -1)
+    {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? NULL : (char *)base;
+}
+
+Clinic *createClinic(const ClinicConfig &config)
+{
+    Arena arena = {NULL, 0, 0, config.processes};
+    layoutClinic(arena, config);
+
+    arena.size = alignUp(arena.used, CACHE_LINE);
+    arena.used = 0;
+    arena.base = arena.shared ? mapSharedArena(arena.size) : (char *)aligned_alloc(CACHE_LINE, arena.size);
+    if (arena.base == NULL)
+    {
+        fprintf(stderr, "Clinic arena: cannot allocate %zu bytes\n", arena.size);
+        exit(1);
+    }
+    memset(arena.base, 0, arena.size);
+
+    return layoutClinic(arena, config);
+}
+
+void destroyClinic(Clinic *clinic)
+{
+    const ClinicConfig &config = clinic->config;
+
+    clinic->runQueueItems.destroy();
+    clinic->allPatientsLeft.destroy();
+    clinic->patientCheckIn.destroy();
+    clinic->doctorsReady.destroy();
+
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+    {
+        NurseState &nurse = clinic->nurses[nurseId];
+        nurse.patientJoinWaitRoom.destroy();
+        nurse.seatFree.destroy();
+        nurse.~NurseState();
+    }
+
+    for (int doctorId = 0; doctorId < config.numDoctors; doctorId++)
+    {
+        DoctorState &doctor = clinic->doctors[doctorId];
+        doctor.ready.destroy();
+        doctor.assigned.destroy();
+        doctor.patientSymptom.destroy();
+        doctor.patientLeave.destroy();
+        doctor.~DoctorState();
+    }
+
+    Arena arena = clinic->arena;
+    clinic->~Clinic();
+    if (arena.shared)
+        munmap(arena.base, arena.size);
+    else
+        free(arena.base);
+}
+
+// Bytes of clinic state per entity, measured with the same layout used to allocate it
+void printMemoryFootprint(const Clinic *clinic)
+{
+    const ClinicConfig &config = clinic->config;
+
+    size_t patientBytes = sizeof(clinic->patientState[0]) + sizeof(clinic->nurseOfPatient[0]) + sizeof(clinic->doctorOfPatient[0]) + sizeof(clinic->arrivedAt[0]) + sizeof(clinic->phaseStartedAt[0]) + sizeof(clinic->priorityOfPatient[0]);
+
+    size_t nurseBytes = sizeof(NurseState);
+    for (int lane = 0; lane < PRIORITY_COUNT * config.numReceptionists; lane++)
+        nurseBytes += sizeof(SpscRing<int>) + SpscRing<int>::storageBytes(clinic->nurses[0].room.lanes[lane].capacity());
+    size_t sharedBytes = sizeof(Clinic) + AdmissionQueue::storageBytes(clinic->admission.capacity()) + DoctorPool::storageBytes(clinic->readyDoctors.capacity());
+
+    printf("Clinic state %zu bytes: %zu per patient, %zu per receptionist, %zu per nurse, %zu per doctor, %zu per worker, %zu shared (%.1f bytes per patient overall)\n",
+           clinic->arena.size, patientBytes, sizeof(ReceptionistState), nurseBytes, sizeof(DoctorState), sizeof(WorkerState), sharedBytes,
+           (double)clinic->arena.size / config.numPatients);
+}
+
+// Patients registered per second, from the first registration to the last across all receptionists
+void printRegistrationReport(const Clinic *clinic)
+{
+    int registered = 0;
+    double first = 0, last = 0;
+
+    for (int receptionistId = 0; receptionistId < clinic->config.numReceptionists; receptionistId++)
+    {
+        const ReceptionistState &receptionist = clinic->receptionists[receptionistId];
+        if (receptionist.patients == 0)
+            continue;
+
+        if (registered == 0 || receptionist.firstRegister < first)
+            first = receptionist.firstRegister;
+        if (registered == 0 || receptionist.lastRegister > last)
+            last = receptionist.lastRegister;
+        registered += receptionist.patients;
+    }
+
+    printf("Registration: %d patients by %d receptionists in %.3f s (%.0f patients/s)\n",
+           registered, clinic->config.numReceptionists, last - first, last > first ? registered / (last - first) : 0.0);
+}
+
+// How evenly patients spread over nurses under the chosen assignment and stealing policy
+void printAssignmentReport(const Clinic *clinic)
+{
+    const ClinicConfig &config = clinic->config;
+
+    int samples = 0;
+    double lengthTotal = 0, varianceTotal = 0;
+    for (int receptionistId = 0; receptionistId < config.numReceptionists; receptionistId++)
+    {
+        samples += clinic->receptionists[receptionistId].roomSamples;
+        lengthTotal += clinic->receptionists[receptionistId].roomLengthTotal;
+        varianceTotal += clinic->receptionists[receptionistId].roomVarianceTotal;
+    }
+
+    int taken = 0, stolen = 0;
+    double waitTotal = 0, waitMax = 0;
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+    {
+        const NurseState &nurse = clinic->nurses[nurseId];
+        taken += nurse.patientsTaken;
+        stolen += nurse.patientsStolen;
+        waitTotal += nurse.waitTotal;
+        if (nurse.waitMax > waitMax)
+            waitMax = nurse.waitMax;
+    }
+
+    printf("Assignment %s, stealing %s: room length mean %.2f variance %.2f, wait in room mean %.1f us max %.1f us, %d of %d patients stolen\n",
+           config.assignPolicy == ASSIGN_SHORTEST ? "shortest" : "random", config.steal ? "on" : "off",
+           samples ? lengthTotal / samples : 0.0, samples ? varianceTotal / samples : 0.0,
+           taken ? waitTotal / taken * 1e6 : 0.0, waitMax * 1e6, stolen, taken);
+}
+
+// What full rooms cost: patients diverted to another room or turned away, and time receptionists spent
+// waiting for a seat. Only when rooms have a capacity
+void printOverflowReport(const Clinic *clinic)
+{
+    const ClinicConfig &config = clinic->config;
+
+    if (config.roomCapacity == 0)
+        return;
+
+    int diverted = 0, shed = 0;
+    double blockedTotal = 0;
+    for (int receptionistId = 0; receptionistId < config.numReceptionists; receptionistId++)
+    {
+        const ReceptionistState &receptionist = clinic->receptionists[receptionistId];
+        diverted += receptionist.patientsDiverted;
+        shed += receptionist.patientsShed;
+        blockedTotal += receptionist.blockedTotal;
+    }
+
+    printf("Rooms of %d seats, overflow %s: %d diverted, %d shed (%.1f%%) of %d patients, receptionists blocked %.3f s\n",
+           config.roomCapacity, overflowNames[config.overflow], diverted, shed, 100.0 * shed / config.numPatients,
+           config.numPatients, blockedTotal);
+}
+
+// Share of the run each doctor spent with a patient, and patients seen per second
+void printDoctorReport(const Clinic *clinic)
+{
+    const ClinicConfig &config = clinic->config;
+    double runTime = clinic->lastPatientLeftAt - clinic->openedAt;
+
+    if (config.placement != PLACE_NONE && config.engine == ENGINE_THREADS)
+    {
+        printf("Placement %s over ", placementNames[config.placement]);
+        printTopology(clinic->topology);
+    }
+
+    // A simulation without service times is over at virtual time zero
+    if (runTime <= 0)
+    {
+        printf("Doctors %s: every patient seen at time zero\n", config.dispatchPolicy == DISPATCH_PINNED ? "pinned" : "shared");
+        return;
+    }
+
+    // Patients turned away at a full room do not count, so this is the goodput
+    int seen = 0;
+    double busyTotal = 0, busyMin = 0, busyMax = 0;
+    for (int doctorId = 0; doctorId < config.numDoctors; doctorId++)
+    {
+        double busy = clinic->doctors[doctorId].busyTotal;
+        seen += clinic->doctors[doctorId].patientsSeen;
+        busyTotal += busy;
+        if (doctorId == 0 || busy < busyMin)
+            busyMin = busy;
+        if (doctorId == 0 || busy > busyMax)
+            busyMax = busy;
+    }
+
+    printf("Doctors %s: utilization mean %.1f%% min %.1f%% max %.1f%%, throughput %.0f patients/s\n",
+           config.dispatchPolicy == DISPATCH_PINNED ? "pinned" : "shared",
+           100 * busyTotal / config.numDoctors / runTime, 100 * busyMin / runTime, 100 * busyMax / runTime,
+           seen / runTime);
+}
+
+// Offered load: how fast patients actually arrived, and how hard that drives the doctors, who are
+// held from the nurse's handoff to the patient leaving.
+// Plus how late timed waits woke, which bounds how much the service times can be trusted
+void printArrivalReport(const Clinic *clinic)
+{
+    const ClinicConfig &config = clinic->config;
+
+    double first = clinic->arrivedAt[0], last = clinic->arrivedAt[0];
+    for (int patientId = 1; patientId < config.numPatients; patientId++)
+    {
+        if (clinic->arrivedAt[patientId] < first)
+            first = clinic->arrivedAt[patientId];
+        if (clinic->arrivedAt[patientId] > last)
+            last = clinic->arrivedAt[patientId];
+    }
+
+    if (last > first)
+    {
+        double rate = (config.numPatients - 1) / (last - first);
+        printf("Arrivals %s: %d patients over %.3f s (%.1f patients/s), offered doctor load %.1f%%\n",
+               arrivalNames[config.arrivals], config.numPatients, last - first, rate,
+               100 * rate * (config.nurseService.mean + config.doctorService.mean) / config.numDoctors);
+    }
+    else
+    {
+        printf("Arrivals %s: %d patients at once\n", arrivalNames[config.arrivals], config.numPatients);
+    }
+
+    const LatencyHistogram &lateness = clinic->timerLateness;
+    if (lateness.count() > 0)
+    {
+        printf("Timed waits %s: %llu, late p50 %.1f us p99 %.1f us max %.1f us\n",
+               timingNames[config.timing], (unsigned long long)lateness.count(),
+               lateness.percentile(0.5) / 1e3, lateness.percentile(0.99) / 1e3, lateness.max() / 1e3);
+    }
+}
+
+// Waiting room and end to end percentiles per triage class, in microseconds. Only when patients were triaged
+void printTriageReport(const Clinic *clinic)
+{
+    const ClinicConfig &config = clinic->config;
+
+    if (config.triageShare[PRIORITY_STANDARD] == 100)
+        return;
+
+    printf("Triage weights %d:%d:%d\n", config.triageWeights[PRIORITY_URGENT], config.triageWeights[PRIORITY_STANDARD], config.triageWeights[PRIORITY_LOW]);
+    printf("%-16s %10s %10s %10s %10s %10s %10s %10s\n", "Triage (us)", "count", "wait p50", "wait p99", "wait max", "e2e p50", "e2e p99", "e2e max");
+
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+    {
+        const LatencyHistogram &wait = clinic->classWaitLatency[priority];
+        const LatencyHistogram &endToEnd = clinic->classEndToEndLatency[priority];
+        printf("%-16s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", priorityNames[priority], (unsigned long long)endToEnd.count(),
+               wait.percentile(0.5) / 1e3, wait.percentile(0.99) / 1e3, wait.max() / 1e3,
+               endToEnd.percentile(0.5) / 1e3, endToEnd.percentile(0.99) / 1e3, endToEnd.max() / 1e3);
+    }
+}
+
+// Percentiles of the time patients spent in each phase, in microseconds
+void printLatencyReport(const Clinic *clinic)
+{
+    printf("%-16s %10s %10s %10s %10s %10s %10s\n", "Latency (us)", "count", "p50", "p90", "p99", "p99.9", "max");
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        const LatencyHistogram &histogram = clinic->phaseLatency[phase];
+        printf("%-16s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", phaseNames[phase], (unsigned long long)histogram.count(),
+               histogram.percentile(0.5) / 1e3, histogram.percentile(0.9) / 1e3, histogram.percentile(0.99) / 1e3,
+               histogram.percentile(0.999) / 1e3, histogram.max() / 1e3);
+    }
+}
+
+// ----- Thread procedures
+
+// Record seconds of phase under the patient's triage class. Only the waiting room and end to end are kept per class
+void recordClassLatency(Clinic &clinic, int patientId, PatientPhase phase, double seconds)
+{
+    int priority = clinic.priorityOfPatient[patientId];
+
+    if (phase == PHASE_WAITING_ROOM)
+        clinic.classWaitLatency[priority].record((uint64_t)(seconds * 1e9));
+    else if (phase == PHASE_END_TO_END)
+        clinic.classEndToEndLatency[priority].record((uint64_t)(seconds * 1e9));
+}
+
+double endPhase(Clinic &clinic, int patientId, PatientPhase phase, double now)
+{
+    double elapsed = now - clinic.phaseStartedAt[patientId];
+    clinic.phaseLatency[phase].record((uint64_t)(elapsed * 1e9));
+    recordClassLatency(clinic, patientId, phase, elapsed);
+    traceClinic(clinic, TRACK_PATIENT, patientId, phaseNames[phase], -1, clinic.phaseStartedAt[patientId], now);
+    clinic.phaseStartedAt[patientId] = now;
+    return elapsed;
+}
+
+// Patient lifecycle. A patient is a task that runs one step on a worker, then parks until staff schedules its next step
+enum PatientState
+{
+    PATIENT_ARRIVING,  // Enters waiting room and lines up for a receptionist. Parked until a nurse takes patient to doctor's office
+    PATIENT_IN_OFFICE, // Nurse took patient to doctor's office, tells symptoms
+    PATIENT_ADVISED    // Doctor gave advice, patient leaves
+};
+
+// Pop an entry a semaphore wake-up promised. A push claims its cell before filling it, so the pop can still find
+// an earlier push in flight ahead of the one that posted. Only for as long as that push takes
+void takeQueued(MpmcRing<int> &ring, int &item)
+{
+    while (!ring.pop(item))
+        sched_yield();
+}
+
+// Queue the next step of a patient for the worker pool
+void schedulePatient(Clinic &clinic, int patientId, PatientState state)
+{
+    clinic.patientState[patientId] = state;
+
+    // Sized so it is never full
+    clinic.runQueue.push(patientId);
+    semPost(clinic.runQueueItems, "runQueueItems");
+}
+
+void lastPatientLeft(Clinic &clinic)
+{
+    clinic.lastPatientLeftAt = clinic.lastLeftAt.load();
+    semPost(clinic.allPatientsLeft, "allPatientsLeft");
+}
+
+// Count a patient out. Whoever empties the clinic after the door closed, patient or door, wakes the main thread
+void leaveClinic(Clinic &clinic, double leftAt)
+{
+    // Before the count drops, so the one that takes it to zero sees every patient's time
+    double latest = clinic.lastLeftAt.load(std::memory_order_relaxed);
+    while (leftAt > latest && !clinic.lastLeftAt.compare_exchange_weak(latest, leftAt, std::memory_order_relaxed))
+        ;
+
+    if (clinic.patientsInside.fetch_sub(1) == 1)
+        lastPatientLeft(clinic);
+}
+
+// Run one step of a patient. Never blocks: every wait is a park until staff schedules the next step
+void runPatientStep(Clinic &clinic, int patientId)
+{
+    switch (clinic.patientState[patientId])
+    {
+    case PATIENT_ARRIVING:
+    {
+        // --- Register phase
+
+        logEvent(EV_PATIENT_ENTERS, patientId);
+
+        // Line up for the receptionists. Only full when they are far behind, so give them a chance to catch up
+        while (!clinic.admission.push(patientId))
+            sched_yield();
+
+        semPost(clinic.patientCheckIn, "patientCheckIn");
+
+        // --- Nurse phase: parked until nurse takes patient to doctor's office
+        break;
+    }
+
+    case PATIENT_IN_OFFICE:
+    {
+        // --- Doctor phase
+
+        int assignedDoctorId = clinic.doctorOfPatient[patientId];
+
+        endPhase(clinic, patientId, PHASE_HANDOFF, monotonicSeconds());
+
+        logEvent(EV_PATIENT_IN_OFFICE, patientId, assignedDoctorId);
+
+        semPost(clinic.doctors[assignedDoctorId].patientSymptom, "patientSymptom - assignedDoctorId");
+        break;
+    }
+
+    case PATIENT_ADVISED:
+    {
+        int assignedDoctorId = clinic.doctorOfPatient[patientId];
+
+        logEvent(EV_PATIENT_ADVISED, patientId, assignedDoctorId);
+
+        semPost(clinic.doctors[assignedDoctorId].patientLeave, "patientLeave - assignedDoctorId");
+
+        // --- Leave phase
+
+        logEvent(EV_PATIENT_LEAVES, patientId);
+
+        double leftAt = monotonicSeconds();
+        endPhase(clinic, patientId, PHASE_CONSULTATION, leftAt);
+        clinic.phaseLatency[PHASE_END_TO_END].record((uint64_t)((leftAt - clinic.arrivedAt[patientId]) * 1e9));
+        recordClassLatency(clinic, patientId, PHASE_END_TO_END, leftAt - clinic.arrivedAt[patientId]);
+
+        leaveClinic(clinic, leftAt);
+        break;
+    }
+    }
+}
+
+void *workerThread(void *arg)
+{
+    Clinic &clinic = *((WorkerState *)arg)->clinic;
+
+    while (true)
+    {
+        // Sleep until a patient step is ready
+        semWait(clinic.runQueueItems, "runQueueItems");
+
+        int patientId;
+        takeQueued(clinic.runQueue, patientId);
+
+        if (patientId == -1)
+            break;
+
+        runPatientStep(clinic, patientId);
+    }
+
+    return arg;
+}
+
+// Hold the calling staff thread for one draw of service, counted from since. Returns when the service was
+// due to end, since itself when there is none
+double serve(Clinic &clinic, const ServiceTime &service, Xoshiro256 &random, double since)
+{
+    if (service.mean <= 0)
+        return since;
+
+    double deadline = since + sampleService(service, random);
+    waitUntil(clinic, deadline);
+    return deadline;
+}
+
+// Post every patient this receptionist seated in the nurse's room since the last announcement. One post per
+// patient keeps the count exact for stealing and closing, but only the first can find the nurse asleep.
+// The nurse then takes the rest of the batch without sleeping in between
+void announcePatients(Clinic &clinic, ReceptionistState &receptionist, int nurseId)
+{
+    NurseState &nurse = clinic.nurses[nurseId];
+
+    receptionist.unannouncedTotal -= receptionist.unannounced[nurseId];
+    for (; receptionist.unannounced[nurseId] > 0; receptionist.unannounced[nurseId]--)
+        semPost(nurse.patientJoinWaitRoom, "patientJoinWaitRoom - nurseId");
+}
+
+void announceAllPatients(Clinic &clinic, ReceptionistState &receptionist)
+{
+    for (int nurseId = 0; nurseId < clinic.config.numNurses && receptionist.unannouncedTotal > 0; nurseId++)
+        announcePatients(clinic, receptionist, nurseId);
+}
+
+// findFreeSeat, then blocking on nurseId's room when the policy says to. Returns the nurse whose room the seat
+// is in, or -1 when the patient is turned away
+int findSeat(Clinic &clinic, ReceptionistState &receptionist, int nurseId)
+{
+    int seatNurseId = findFreeSeat(clinic.config, receptionist, nurseId,
+                                   [&](int room) { return semTryWait(clinic.nurses[room].seatFree, "seatFree - nurseId"); });
+    if (seatNurseId != -1 || clinic.config.overflow == OVERFLOW_REJECT)
+        return seatNurseId;
+
+    // Patients held back for a batch may be what fills the room, and its nurse only takes them once told
+    announceAllPatients(clinic, receptionist);
+
+    double blockedSince = monotonicSeconds();
+    semWait(clinic.nurses[nurseId].seatFree, "seatFree - nurseId");
+    receptionist.blockedTotal += monotonicSeconds() - blockedSince;
+    return nurseId;
+}
+
+// Sleep until a patient checks in. False when the oldest unannounced patient's timeout passes first, even with
+// more patients checked in, so a long burst cannot hold anyone past it
+bool waitForCheckIn(Clinic &clinic, ReceptionistState &receptionist)
+{
+    if (receptionist.unannouncedTotal == 0)
+    {
+        semWait(clinic.patientCheckIn, "patientCheckIn");
+        return true;
+    }
+
+    double remaining = receptionist.oldestUnannounced + clinic.config.admissionTimeout - monotonicSeconds();
+    if (remaining <= 0)
+        return false;
+
+    return semTimedWait(clinic.patientCheckIn, "patientCheckIn", (long)(remaining * 1e9));
+}
+
+void *receptionistThread(void *arg)
+{
+    ReceptionistState &receptionist = *(ReceptionistState *)arg;
+    Clinic &clinic = *receptionist.clinic;
+
+    while (true)
+    {
+        // Wait for a patient to check in. Patients held back for a batch go out once nobody new comes in time
+        if (!waitForCheckIn(clinic, receptionist))
+        {
+            announceAllPatients(clinic, receptionist);
+            continue;
+        }
+
+        int patientId;
+        takeQueued(clinic.admission, patientId);
+
+        if (patientId == -1)
+        {
+            announceAllPatients(clinic, receptionist);
+            break;
+        }
+
+        double registerStart = monotonicSeconds();
+        endPhase(clinic, patientId, PHASE_RECEPTION_WAIT, registerStart);
+        if (receptionist.patients == 0)
+            receptionist.firstRegister = registerStart;
+
+        logEvent(EV_RECEPTIONIST_RECEIVES, receptionist.id, patientId);
+
+        serve(clinic, clinic.config.receptionService, receptionist.random, registerStart);
+
+        int assignedNurseId = assignNurse(clinic.config, receptionist, patientId, [&](int room) { return clinic.nurses[room].room.size(); });
+        int nurseId = findSeat(clinic, receptionist, assignedNurseId);
+        clinic.nurseOfPatient[patientId] = nurseId;
+
+        Priority priority = randomPriority(clinic.config, patientId);
+        clinic.priorityOfPatient[patientId] = priority;
+
+        // Room full: the patient leaves without seeing a doctor
+        if (nurseId == -1)
+        {
+            logEvent(EV_PATIENT_TURNED_AWAY, patientId, assignedNurseId);
+
+            double leftAt = monotonicSeconds();
+            endPhase(clinic, patientId, PHASE_REGISTRATION, leftAt);
+            traceClinic(clinic, TRACK_RECEPTIONIST, receptionist.id, "registration", patientId, registerStart, leftAt);
+            receptionist.patientsShed++;
+
+            leaveClinic(clinic, leftAt);
+            continue;
+        }
+
+        NurseState &nurse = clinic.nurses[nurseId];
+
+        // Registration done. Patient leaves the receptionist for the nurse's waiting room
+        logEvent(EV_PATIENT_SITS, patientId);
+
+        // Add that patient to this receptionist's lane for its class in the nurse's wait room. Only full when the nurse is far behind, so give the nurse a chance to catch up
+        while (!nurse.room.lane(priority, receptionist.id).push(patientId))
+            sched_yield();
+
+        // The nurse reads the phase start only after the wake-up below
+        double joinedRoomAt = monotonicSeconds();
+        endPhase(clinic, patientId, PHASE_REGISTRATION, joinedRoomAt);
+        traceClinic(clinic, TRACK_RECEPTIONIST, receptionist.id, "registration", patientId, registerStart, joinedRoomAt);
+
+        // Increase processed patients for this receptionist
+        receptionist.patients++;
+        receptionist.lastRegister = joinedRoomAt;
+        statsSeated(clinic, receptionist, nurseId);
+
+        sampleRoomLengths(clinic.config, receptionist, [&](int room) { return clinic.nurses[room].room.size(); });
+
+        // Tell nurse that a new patient joins waiting room, along with the rest of the batch once it is full
+        if (receptionist.unannouncedTotal == 0)
+            receptionist.oldestUnannounced = joinedRoomAt;
+        receptionist.unannounced[nurseId]++;
+        receptionist.unannouncedTotal++;
+
+        if (receptionist.unannounced[nurseId] >= clinic.config.admissionBatch)
+            announcePatients(clinic, receptionist, nurseId);
+    }
+
+    return arg;
+}
+
+// Claim one waiting patient from a sibling's room. Returns that sibling's id, or -1 when every other room is empty
+int stealPatient(Clinic &clinic, NurseState &nurse)
+{
+    int numNurses = clinic.config.numNurses;
+
+    for (int i = 1; i < numNurses; i++)
+    {
+        int siblingId = (nurse.id + i) % numNurses;
+        NurseState &sibling = clinic.nurses[siblingId];
+
+        if (sibling.room.size() > 0 && semTryWait(sibling.patientJoinWaitRoom, "patientJoinWaitRoom - siblingId"))
+            return siblingId;
+    }
+
+    return -1;
+}
+
+// Sleep until a patient joins this nurse's wait room or the clinic closes. With stealing, an idle nurse
+// also looks through siblings' rooms and only naps briefly on its own. Returns the id of the nurse whose room it claimed a patient from
+int waitForPatient(Clinic &clinic, NurseState &nurse)
+{
+    if (!clinic.config.steal)
+    {
+        semWait(nurse.patientJoinWaitRoom, "patientJoinWaitRoom - nurseId");
+        return nurse.id;
+    }
+
+    while (true)
+    {
+        if (semTryWait(nurse.patientJoinWaitRoom, "patientJoinWaitRoom - nurseId"))
+            return nurse.id;
+
+        int siblingId = stealPatient(clinic, nurse);
+        if (siblingId != -1)
+            return siblingId;
+
+        if (semTimedWait(nurse.patientJoinWaitRoom, "patientJoinWaitRoom - nurseId", STEAL_POLL_NS))
+            return nurse.id;
+    }
+}
+
+// Returns the id of a doctor ready for a new patient, reserved for this nurse
+int waitForDoctor(Clinic &clinic, NurseState &nurse)
+{
+    if (clinic.config.dispatchPolicy == DISPATCH_PINNED)
+    {
+        int doctorId = nurse.id % clinic.config.numDoctors;
+        semWait(clinic.doctors[doctorId].ready, "doctorReady - doctorId");
+        return doctorId;
+    }
+
+    // The wake-up guarantees an id is in the pool
+    semWait(clinic.doctorsReady, "doctorsReady");
+
+    int doctorId;
+    takeQueued(clinic.readyDoctors, doctorId);
+    return doctorId;
+}
+
+void *nurseThread(void *arg)
+{
+    NurseState &nurse = *(NurseState *)arg;
+    Clinic &clinic = *nurse.clinic;
+
+    while (true)
+    {
+        int roomNurseId = waitForPatient(clinic, nurse);
+        NurseState &roomNurse = clinic.nurses[roomNurseId];
+
+        // Every patient has already been seen, so this wake-up is the closing signal
+        if (clinic.clinicClosing)
+        {
+            // A closing signal taken from a sibling's room belongs to that sibling
+            if (roomNurseId != nurse.id)
+                semPost(roomNurse.patientJoinWaitRoom, "patientJoinWaitRoom - siblingId");
+            break;
+        }
+
+        // Wait for a doctor to ready
+        DoctorState &doctor = clinic.doctors[waitForDoctor(clinic, nurse)];
+
+        // Take patient out of wait room and to doctor's office. The wake-up above guarantees one is there
+        int patientId;
+        if (clinic.config.steal)
+            roomNurse.room.popShared(patientId);
+        else
+            nurse.room.pop(patientId);
+
+        if (roomNurseId != nurse.id)
+        {
+            logEvent(EV_NURSE_STEALS, nurse.id, patientId, roomNurseId);
+            clinic.nurseOfPatient[patientId] = nurse.id;
+            nurse.patientsStolen++;
+        }
+
+        logEvent(EV_NURSE_TAKES, nurse.id, patientId);
+
+        // The patient's seat is free for the next one
+        if (clinic.config.roomCapacity > 0)
+            semPost(roomNurse.seatFree, "seatFree - nurseId");
+
+        double takenAt = monotonicSeconds();
+        double wait = endPhase(clinic, patientId, PHASE_WAITING_ROOM, takenAt);
+        nurse.patientsTaken++;
+        nurse.waitTotal += wait;
+        if (wait > nurse.waitMax)
+            nurse.waitMax = wait;
+        statsTaken(clinic, nurse, roomNurseId);
+
+        doctor.patientId = patientId;
+        clinic.doctorOfPatient[patientId] = doctor.id;
+
+        // Wake up doctor for the new patient
+        semPost(doctor.assigned, "doctorAssigned - doctorId");
+
+        // Walk the patient to the office. The doctor already counts as busy, as it waits for nobody else
+        double inOfficeAt = serve(clinic, clinic.config.nurseService, nurse.random, takenAt);
+        traceClinic(clinic, TRACK_NURSE, nurse.id, "escort", patientId, takenAt, inOfficeAt);
+
+        // Signal front patient that it's their turn
+        schedulePatient(clinic, patientId, PATIENT_IN_OFFICE);
+    }
+
+    return arg;
+}
+
+void readyDoctor(Clinic &clinic, DoctorState &doctor)
+{
+    if (clinic.config.dispatchPolicy == DISPATCH_PINNED)
+    {
+        semPost(doctor.ready, "doctorReady - doctorId");
+        return;
+    }
+
+    // Never full: the pool has room for every doctor
+    clinic.readyDoctors.push(doctor.id);
+    semPost(clinic.doctorsReady, "doctorsReady");
+}
+
+void *doctorThread(void *arg)
+{
+    DoctorState &doctor = *(DoctorState *)arg;
+    Clinic &clinic = *doctor.clinic;
+
+    while (true)
+    {
+        // Sleep until nurse sends in a patient or the clinic closes
+        semWait(doctor.assigned, "doctorAssigned - doctorId");
+
+        if (clinic.clinicClosing)
+            break;
+
+        doctor.busySince = monotonicSeconds();
+        statsDoctor(clinic, doctor, true);
+
+        int patientId = doctor.patientId;
+
+        // Wait for current patient to tell symptoms
+        semWait(doctor.patientSymptom, "patientSymptom");
+
+        logEvent(EV_DOCTOR_LISTENS, doctor.id, patientId);
+
+        serve(clinic, clinic.config.doctorService, doctor.random, monotonicSeconds());
+
+        // Give advice to patient
+        schedulePatient(clinic, patientId, PATIENT_ADVISED);
+
+        // Wait for patient to leave
+        semWait(doctor.patientLeave, "patientLeave - doctorId");
+
+        // Reset current patient of doctor to no one
+        doctor.patientId = -1;
+
+        double freeAt = monotonicSeconds();
+        doctor.patientsSeen++;
+        doctor.busyTotal += freeAt - doctor.busySince;
+        statsDoctor(clinic, doctor, false);
+        traceClinic(clinic, TRACK_DOCTOR, doctor.id, "consultation", patientId, doctor.busySince, freeAt);
+
+        // Tell nurses that doctor is ready for next patient
+        readyDoctor(clinic, doctor);
+    }
+
+    return arg;
+}
+
+// ----- Front door
+
+// The door counts as one more patient inside, so the clinic only empties once it is closed
+void openDoor(Clinic &clinic)
+{
+    clinic.openedAt = monotonicSeconds();
+    clinic.patientsInside.store(1);
+}
+
+int admitPatient(Clinic &clinic, double arrivedAt)
+{
+    int patientId = clinic.patientsAdmitted++;
+
+    clinic.arrivedAt[patientId] = arrivedAt;
+    clinic.phaseStartedAt[patientId] = arrivedAt;
+    clinic.patientsInside.fetch_add(1);
+    statsAdmitted(clinic, clinic.patientsAdmitted);
+
+    schedulePatient(clinic, patientId, PATIENT_ARRIVING);
+    return patientId;
+}
+
+void closeDoor(Clinic &clinic)
+{
+    if (clinic.patientsInside.fetch_sub(1) == 1)
+    {
+        // Everyone admitted had already left. Nobody came at all when nobody left either
+        if (clinic.patientsAdmitted == 0)
+            clinic.lastLeftAt.store(monotonicSeconds());
+        lastPatientLeft(clinic);
+    }
+}
+
+int patientsWaiting(const Clinic &clinic)
+{
+    return clinic.patientsInside.load(std::memory_order_relaxed) - 1;
+}
+
+// ----- Init threads
+
+int errcode; /* holds pthread error code */
+void *status; /* holds return code */
+
+enum StaffRole
+{
+    ROLE_WORKER,
+    ROLE_RECEPTIONIST,
+    ROLE_NURSE,
+    ROLE_DOCTOR
+};
+
+void addCore(const Topology &topology, int core, cpu_set_t &cpus)
+{
+    for (int cpu : topology.cores[core])
+        CPU_SET(cpu, &cpus);
+}
+
+// CPUs the thread of role and id may run on under the placement policy. False to leave it to the kernel
+bool placeByPolicy(const Clinic &clinic, StaffRole role, int id, cpu_set_t &cpus)
+{
+    const ClinicConfig &config = clinic.config;
+    const Topology &topology = clinic.topology;
+    int numCores = topology.cores.size();
+
+    CPU_ZERO(&cpus);
+
+    switch (config.placement)
+    {
+    case PLACE_NONE:
+        return false;
+
+    case PLACE_PAIRED:
+    {
+        // Nurse n hands its patients to doctor n % doctors when pinned, so that pair shares a core
+        if (role != ROLE_NURSE && role != ROLE_DOCTOR)
+            return false;
+
+        int pair = role == ROLE_NURSE ? id % config.numDoctors : id;
+        const std::vector<int> &core = topology.cores[pair % numCores];
+        CPU_SET(core[role == ROLE_NURSE && core.size() > 1 ? 1 : 0], &cpus);
+        return true;
+    }
+
+    case PLACE_ISOLATED:
+    {
+        // The last cores go to receptionists, leaving at least one for everyone else
+        int reserved = config.numReceptionists < numCores - 1 ? config.numReceptionists : numCores - 1;
+        if (reserved < 1)
+            return false;
+
+        if (role == ROLE_RECEPTIONIST)
+        {
+            addCore(topology, numCores - reserved + id % reserved, cpus);
+            return true;
+        }
+
+        for (int core = 0; core < numCores - reserved; core++)
+            addCore(topology, core, cpus);
+        return true;
+    }
+
+    case PLACE_SPREAD:
+    {
+        if (topology.nodes < 2)
+            return false;
+
+        int slot = role == ROLE_NURSE ? id % config.numDoctors : id;
+        int node = slot % topology.nodes;
+        for (int core = 0; core < numCores; core++)
+        {
+            if (topology.nodeOfCore[core] == node)
+                addCore(topology, core, cpus);
+        }
+        return true;
+    }
+    }
+
+    return false;
+}
+
+// placeByPolicy, except that a confined clinic keeps the threads the policy leaves alone on its own cores
+bool placeStaff(const Clinic &clinic, StaffRole role, int id, cpu_set_t &cpus)
+{
+    if (placeByPolicy(clinic, role, id, cpus))
+        return true;
+    if (!clinic.confined)
+        return false;
+
+    CPU_ZERO(&cpus);
+    for (int core = 0; core < (int)clinic.topology.cores.size(); core++)
+        addCore(clinic.topology, core, cpus);
+    return true;
+}
+
+// Attributes for the thread of role and id, or NULL for the defaults. Destroy attr after pthread_create when not NULL
+pthread_attr_t *staffAttributes(const Clinic &clinic, StaffRole role, int id, pthread_attr_t &attr)
+{
+    cpu_set_t cpus;
+    if (!placeStaff(clinic, role, id, cpus))
+        return NULL;
+
+    pthread_attr_init(&attr);
+    errcode = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    if (errcode)
+    {
+        errexit(errcode, "pthread_attr_setaffinity_np");
+    }
+    return &attr;
+}
+
+void initSemaphores(Clinic &clinic)
+{
+    semInit(clinic.runQueueItems, "runQueueItems", 0, clinic.config);
+
+    semInit(clinic.allPatientsLeft, "allPatientsLeft", 0, clinic.config);
+
+    semInit(clinic.patientCheckIn, "patientCheckIn", 0, clinic.config);
+
+    for (int nurseId = 0; nurseId < clinic.config.numNurses; nurseId++)
+    {
+        semInit(clinic.nurses[nurseId].patientJoinWaitRoom, "patientJoinWaitRoom - nurseId", 0, clinic.config);
+        semInit(clinic.nurses[nurseId].seatFree, "seatFree - nurseId", clinic.config.roomCapacity, clinic.config);
+    }
+
+    semInit(clinic.doctorsReady, "doctorsReady", 0, clinic.config);
+
+    for (int doctorId = 0; doctorId < clinic.config.numDoctors; doctorId++)
+    {
+        semInit(clinic.doctors[doctorId].ready, "doctorReady - doctorId", 0, clinic.config);
+        semInit(clinic.doctors[doctorId].assigned, "doctorAssigned - doctorId", 0, clinic.config);
+
+        semInit(clinic.doctors[doctorId].patientSymptom, "patientSymptom - doctorId", 0, clinic.config);
+        semInit(clinic.doctors[doctorId].patientLeave, "patientLeave - doctorId", 0, clinic.config);
+    }
+}
+
+void initWorkers(Clinic &clinic)
+{
+    int workerId;
+
+    /* Create worker threads */
+    for (workerId = 0; workerId < clinic.config.numWorkers; workerId++)
+    {
+        WorkerState &worker = clinic.workers[workerId];
+
+        // Save worker id
+        worker.id = workerId;
+        worker.clinic = &clinic;
+
+        pthread_attr_t attr;
+        pthread_attr_t *attributes = staffAttributes(clinic, ROLE_WORKER, workerId, attr);
+
+        /* create thread */
+        errcode = pthread_create(&worker.thread, /* thread struct             */
+                                 attributes,     /* placement or defaults     */
+                                 workerThread,   /* start routine             */
+                                 &worker);
+
+        if (attributes != NULL)
+            pthread_attr_destroy(attributes);
+
+        if (errcode)
+        {
+            /* arg to routine */
+            errexit(errcode, "pthread_create");
+        }
+    }
+}
+
+// Runs on the main thread once staff are in, pacing arrivals unless they all come at once. A patient's
+// first step runs as soon as a worker is free, but its latency counts from when it was due to arrive
+void initPatients(Clinic &clinic)
+{
+    const ClinicConfig &config = clinic.config;
+
+    Xoshiro256 random;
+    random.seed(config.seed, randomStream(STREAM_ARRIVAL, 0));
+    double arrival = 0;
+
+    for (int patientId = 0; patientId < config.numPatients; patientId++)
+    {
+        arrival = nextArrival(config, random, patientId, arrival);
+        if (config.arrivals != ARRIVAL_BATCH)
+            waitUntil(clinic, clinic.openedAt + arrival);
+
+        admitPatient(clinic, clinic.openedAt + arrival);
+    }
+
+    closeDoor(clinic);
+}
+
+void initReceptionists(Clinic &clinic)
+{
+    int receptionistId;
+
+    /* Create receptionist threads */
+    for (receptionistId = 0; receptionistId < clinic.config.numReceptionists; receptionistId++)
+    {
+        ReceptionistState &receptionist = clinic.receptionists[receptionistId];
+
+        // Save receptionist id
+        receptionist.id = receptionistId;
+        receptionist.clinic = &clinic;
+
+        pthread_attr_t attr;
+        pthread_attr_t *attributes = staffAttributes(clinic, ROLE_RECEPTIONIST, receptionistId, attr);
+
+        /* create thread */
+        errcode = pthread_create(&receptionist.thread, /* thread struct             */
+                                 attributes,           /* placement or defaults     */
+                                 receptionistThread,   /* start routine             */
+                                 &receptionist);
+
+        if (attributes != NULL)
+            pthread_attr_destroy(attributes);
+
+        if (errcode)
+        {
+            /* arg to routine */
+            errexit(errcode, "pthread_create");
+        }
+    }
+}
+
+void initNurses(Clinic &clinic)
+{
+    int nurseId;
+
+    /* Create nurse threads */
+    for (nurseId = 0; nurseId < clinic.config.numNurses; nurseId++)
+    {
+        NurseState &nurse = clinic.nurses[nurseId];
+
+        // Save nurse id
+        nurse.id = nurseId;
+        nurse.clinic = &clinic;
+
+        pthread_attr_t attr;
+        pthread_attr_t *attributes = staffAttributes(clinic, ROLE_NURSE, nurseId, attr);
+
+        /* create thread */
+        errcode = pthread_create(&nurse.thread, /* thread struct             */
+                                 attributes,    /* placement or defaults     */
+                                 nurseThread,   /* start routine             */
+                                 &nurse);
+
+        if (attributes != NULL)
+            pthread_attr_destroy(attributes);
+
+        if (errcode)
+        {
+            /* arg to routine */
+            errexit(errcode, "pthread_create");
+        }
+    }
+}
+
+void initDoctors(Clinic &clinic)
+{
+    int doctorId;
+
+    /* Create doctor threads */
+    for (doctorId = 0; doctorId < clinic.config.numDoctors; doctorId++)
+    {
+        DoctorState &doctor = clinic.doctors[doctorId];
+
+        // Save doctor id
+        doctor.id = doctorId;
+        doctor.clinic = &clinic;
+        doctor.patientId = -1;
+
+        // Every doctor starts out ready
+        readyDoctor(clinic, doctor);
+
+        pthread_attr_t attr;
+        pthread_attr_t *attributes = staffAttributes(clinic, ROLE_DOCTOR, doctorId, attr);
+
+        /* create thread */
+        errcode = pthread_create(&doctor.thread, /* thread struct             */
+                                 attributes,     /* placement or defaults     */
+                                 doctorThread,   /* start routine             */
+                                 &doctor);
+
+        if (attributes != NULL)
+            pthread_attr_destroy(attributes);
+
+        if (errcode)
+        {
+            /* arg to routine */
+            errexit(errcode, "pthread_create");
+        }
+    }
+}
+
+void closeClinic(Clinic &clinic)
+{
+    // Only called after every patient has left, so all staff are idle and waiting
+    clinic.clinicClosing = true;
+
+    for (int receptionistId = 0; receptionistId < clinic.config.numReceptionists; receptionistId++)
+    {
+        while (!clinic.admission.push(-1))
+            sched_yield();
+        semPost(clinic.patientCheckIn, "patientCheckIn");
+    }
+
+    for (int nurseId = 0; nurseId < clinic.config.numNurses; nurseId++)
+        semPost(clinic.nurses[nurseId].patientJoinWaitRoom, "patientJoinWaitRoom - nurseId");
+
+    for (int doctorId = 0; doctorId < clinic.config.numDoctors; doctorId++)
+        semPost(clinic.doctors[doctorId].assigned, "doctorAssigned - doctorId");
+}
+
+// Join a staff thread and check it handed back its own state, as every thread procedure returns its arg
+void joinThread(pthread_t thread, void *arg, int id)
+{
+    errcode = pthread_join(thread, &status);
+
+    if (errcode)
+    {
+        errexit(errcode, "pthread_join");
+    }
+
+    if (status != arg)
+    {
+        fprintf(stderr, "thread %d terminated abnormally\n", id);
+        exit(1);
+    }
+}
+
+void joinReceptionists(Clinic &clinic)
+{
+    for (int receptionistId = 0; receptionistId < clinic.config.numReceptionists; receptionistId++)
+        joinThread(clinic.receptionists[receptionistId].thread, &clinic.receptionists[receptionistId], receptionistId);
+}
+
+void joinDoctors(Clinic &clinic)
+{
+    for (int doctorId = 0; doctorId < clinic.config.numDoctors; doctorId++)
+        joinThread(clinic.doctors[doctorId].thread, &clinic.doctors[doctorId], doctorId);
+}
+
+void joinNurses(Clinic &clinic)
+{
+    for (int nurseId = 0; nurseId < clinic.config.numNurses; nurseId++)
+        joinThread(clinic.nurses[nurseId].thread, &clinic.nurses[nurseId], nurseId);
+}
+
+// ----- Staff processes
+
+#define STAFF_PROCESSES 3 // Receptionists, doctors, nurses
+
+// Run one role's threads in a child process that shares the clinic through the shared arena. The child
+// exits once its threads have, which is only after closeClinic
+pid_t forkStaff(Clinic &clinic, void (*start)(Clinic &), void (*join)(Clinic &))
+{
+    // Anything still buffered would be written again by the child
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0)
+    {
+        // Staff of a run the main process gave up on, or that crashed, would wait forever
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent)
+            _exit(1);
+
+        start(clinic);
+        join(clinic);
+        _exit(0);
+    }
+
+    return pid;
+}
+
+// A staff process that ends early leaves its patients waiting forever, so give up on the run instead
+void checkStaff(pid_t pid, int status)
+{
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        return;
+
+    if (WIFSIGNALED(status))
+        fprintf(stderr, "Staff process %d killed by signal %d\n", (int)pid, WTERMSIG(status));
+    else
+        fprintf(stderr, "Staff process %d exited with status %d\n", (int)pid, WEXITSTATUS(status));
+    exit(1);
+}
+
+// Sleep until the last patient leaves. With staff in processes, wake now and then to check none has died
+void waitForAllPatients(Clinic &clinic, const pid_t *staff)
+{
+    if (staff == NULL)
+    {
+        semWait(clinic.allPatientsLeft, "allPatientsLeft");
+        return;
+    }
+
+    while (!semTimedWait(clinic.allPatientsLeft, "allPatientsLeft", PROCESS_POLL_NS))
+    {
+        for (int i = 0; i < STAFF_PROCESSES; i++)
+        {
+            int status;
+            if (waitpid(staff[i], &status, WNOHANG) == staff[i])
+            {
+                // Even a clean exit is too early here
+                checkStaff(staff[i], status);
+                fprintf(stderr, "Staff process %d exited before the clinic closed\n", (int)staff[i]);
+                exit(1);
+            }
+        }
+    }
+}
+
+// staff holds the pids of the staff processes, or is NULL when staff are threads of this process
+void exitThreads(Clinic &clinic, const pid_t *staff)
+{
+    waitForAllPatients(clinic, staff);
+
+    // Tell each worker to exit once the run queue drains
+    for (int workerId = 0; workerId < clinic.config.numWorkers; workerId++)
+    {
+        clinic.runQueue.push(-1);
+        semPost(clinic.runQueueItems, "runQueueItems");
+    }
+
+    for (int workerId = 0; workerId < clinic.config.numWorkers; workerId++)
+        joinThread(clinic.workers[workerId].thread, &clinic.workers[workerId], workerId);
+
+    closeClinic(clinic);
+
+    if (staff == NULL)
+    {
+        joinReceptionists(clinic);
+        joinDoctors(clinic);
+        joinNurses(clinic);
+        return;
+    }
+
+    for (int i = 0; i < STAFF_PROCESSES; i++)
+    {
+        int status;
+        if (waitpid(staff[i], &status, 0) == -1)
+        {
+            perror("waitpid");
+            exit(1);
+        }
+        checkStaff(staff[i], status);
+    }
+}
+
+void openClinic(Clinic &clinic)
+{
+    initSemaphores(clinic);
+
+    // A shard is handed its share of the machine before it opens
+    if (clinic.config.placement != PLACE_NONE && clinic.topology.cores.empty())
+        readTopology(clinic.topology);
+
+    openDoor(clinic);
+
+    initWorkers(clinic);
+    initReceptionists(clinic);
+    initDoctors(clinic);
+    initNurses(clinic);
+}
+
+void finishClinic(Clinic &clinic)
+{
+    exitThreads(clinic, NULL);
+}
+
+void runClinic(Clinic &clinic)
+{
+    if (clinic.config.engine == ENGINE_COROUTINES)
+    {
+        runCoroutineClinic(clinic);
+        return;
+    }
+
+    if (clinic.config.engine == ENGINE_SIMULATION)
+    {
+        runSimulatedClinic(clinic);
+        return;
+    }
+
+    if (!clinic.config.processes)
+    {
+        openClinic(clinic);
+        initPatients(clinic);
+        finishClinic(clinic);
+        return;
+    }
+
+    initSemaphores(clinic);
+
+    if (clinic.config.placement != PLACE_NONE)
+        readTopology(clinic.topology);
+
+    openDoor(clinic);
+
+    // Staff first, while this process still has a single thread to fork. Patients stay here on the workers
+    pid_t staff[STAFF_PROCESSES];
+    staff[0] = forkStaff(clinic, initReceptionists, joinReceptionists);
+    staff[1] = forkStaff(clinic, initDoctors, joinDoctors);
+    staff[2] = forkStaff(clinic, initNurses, joinNurses);
+
+    initWorkers(clinic);
+    initPatients(clinic);
+
+    exitThreads(clinic, staff);
+}
@@ -0,0 +1,641 @@
+#ifndef CLINIC_H
+#define CLINIC_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <atomic>
+
+#include "spsc_ring.h"
+#include "mpmc_ring.h"
+#include "latency_histogram.h"
+#include "random.h"
+#include "spin_semaphore.h"
+#include "topology.h"
+#include "stats_page.h"
+#include "trace.h"
+
+// The clinic engine: patients as tasks on a worker pool, staff threads, and the state they share.
+// project2 runs one clinic from the command line, bench runs many of them in one process
+
+// ----- Clinic state
+
+#define CACHE_LINE 64
+
+// Bump allocator over one block. With base == NULL it only measures, so the same layout code sizes and then fills the block
+struct Arena
+{
+    char *base;
+    size_t size;
+    size_t used;
+    bool shared; // Mapped from shared memory for staff processes, instead of allocated
+};
+
+// Triage class a receptionist gives each patient
+enum Priority
+{
+    PRIORITY_URGENT,
+    PRIORITY_STANDARD,
+    PRIORITY_LOW,
+    PRIORITY_COUNT
+};
+
+extern const char *priorityNames[]; // Indexed by Priority
+
+// Which class a nurse takes the next patient from: smooth weighted round robin over the classes with
+// someone waiting. Each of those gains its weight in credit, the richest goes and pays back what they
+// gained together. While every class has patients waiting, a class of weight w goes w times in every
+// (sum of weights) turns, spread evenly, so urgent patients go first most of the time and no class starves
+struct TriagePicker
+{
+    int weights[PRIORITY_COUNT];
+    int credit[PRIORITY_COUNT];
+
+    // waiting[p] says whether class p has anyone waiting. -1 when no one does
+    int pick(const bool waiting[PRIORITY_COUNT])
+    {
+        int best = -1, gained = 0;
+
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+        {
+            if (!waiting[priority])
+                continue;
+
+            credit[priority] += weights[priority];
+            gained += weights[priority];
+            if (best == -1 || credit[priority] > credit[best])
+                best = priority;
+        }
+
+        if (best != -1)
+            credit[best] -= gained;
+        return best;
+    }
+};
+
+// A nurse's waiting room has one lane per triage class and receptionist. Each lane has a single producer
+// (its receptionist) and a single consumer (the nurse), so lanes stay lock-free SPSC rings however many
+// receptionists there are
+struct WaitingRoom
+{
+    SpscRing<int> *lanes; // Array (Size = Priorities * Receptionists) - Lane of receptionist r for class p at p * numLanes + r
+    int numLanes;         // Lanes per class
+    int nextLane[PRIORITY_COUNT]; // Lane of each class the nurse looks at first, rotated so no receptionist's patients wait behind another's
+    TriagePicker triage;
+
+    std::atomic<bool> taking; // Held while taking a patient out once siblings may steal, so lanes still have one consumer at a time
+
+    SpscRing<int> &lane(int priority, int receptionistId)
+    {
+        return lanes[priority * numLanes + receptionistId];
+    }
+
+    // Owning nurse only, or whoever holds taking. False when every lane is empty
+    bool pop(int &patientId)
+    {
+        bool waiting[PRIORITY_COUNT];
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+        {
+            waiting[priority] = false;
+            for (int receptionistId = 0; receptionistId < numLanes && !waiting[priority]; receptionistId++)
+                waiting[priority] = lane(priority, receptionistId).size() > 0;
+        }
+
+        int priority = triage.pick(waiting);
+        if (priority == -1)
+            return false;
+
+        for (int i = 0; i < numLanes; i++)
+        {
+            int receptionistId = nextLane[priority];
+            nextLane[priority] = receptionistId + 1 == numLanes ? 0 : receptionistId + 1;
+
+            if (lane(priority, receptionistId).pop(patientId))
+                return true;
+        }
+
+        return false;
+    }
+
+    // Any nurse, for rooms other nurses can steal from
+    bool popShared(int &patientId)
+    {
+        while (taking.exchange(true, std::memory_order_acquire))
+            sched_yield();
+
+        bool found = pop(patientId);
+
+        taking.store(false, std::memory_order_release);
+        return found;
+    }
+
+    unsigned size() const
+    {
+        unsigned total = 0;
+        for (int lane = 0; lane < PRIORITY_COUNT * numLanes; lane++)
+            total += lanes[lane].size();
+        return total;
+    }
+};
+
+// How the receptionist picks a nurse for a newly registered patient
+enum AssignPolicy
+{
+    ASSIGN_RANDOM,  // Any nurse, uniformly
+    ASSIGN_SHORTEST // Nurse with the fewest patients waiting (join-shortest-queue)
+};
+
+// How a nurse finds a doctor for a patient taken out of a waiting room
+enum DispatchPolicy
+{
+    DISPATCH_SHARED, // Any ready doctor, from the shared pool
+    DISPATCH_PINNED  // Always doctor (nurse id % doctors), waiting on that doctor alone
+};
+
+// What the receptionist does with a patient whose nurse's room is full, when rooms have a capacity
+enum OverflowPolicy
+{
+    OVERFLOW_BLOCK,  // Wait for a seat in that room. Patients back up at the reception desk instead
+    OVERFLOW_DIVERT, // Seat the patient in the next room round with a free seat, or wait as OVERFLOW_BLOCK when none has one
+    OVERFLOW_REJECT  // Turn the patient away. The patient leaves without seeing a doctor
+};
+
+extern const char *overflowNames[]; // Indexed by OverflowPolicy
+
+// Which CPUs the thread engine lets each staff thread run on, laid out from the topology in /sys
+enum Placement
+{
+    PLACE_NONE,     // Leave every thread to the kernel
+    PLACE_PAIRED,   // Nurse n and doctor n % doctors share a core, on sibling hyperthreads where the core has them
+    PLACE_ISOLATED, // Each receptionist alone on a core of its own, every other thread kept off those cores
+    PLACE_SPREAD    // Staff and workers dealt round robin over NUMA nodes, a nurse on its doctor's node
+};
+
+extern const char *placementNames[]; // Indexed by Placement
+
+#define STEAL_POLL_NS 1000000     // How long an idle nurse naps on its own room before looking at siblings' rooms again
+#define PROCESS_POLL_NS 100000000 // How often the main process checks that staff processes are still alive
+
+typedef MpmcRing<int> AdmissionQueue;
+typedef MpmcRing<int> DoctorPool;
+typedef MpmcRing<int> RunQueue;
+
+#define MAX_ROOM_CAPACITY 65536
+#define MAX_ADMISSION_CAPACITY (1 << 20)
+
+// How patients and staff run
+enum ClinicEngine
+{
+    ENGINE_THREADS,   // Staff are threads sleeping on semaphores, patients are tasks on the worker pool
+    ENGINE_COROUTINES, // Patients and staff are coroutines awaiting each other, M:N on the worker pool
+    ENGINE_SIMULATION  // Discrete-event simulation on one thread, in virtual time
+};
+
+extern const char *engineNames[]; // Indexed by ClinicEngine, as given to --engine
+
+// When patients arrive, counted from the clinic opening
+enum ArrivalProcess
+{
+    ARRIVAL_BATCH,   // Everyone at once: a closed system that only measures how fast the clinic drains
+    ARRIVAL_POISSON, // Exponential gaps at arrivalRate: an open system under a steady offered load
+    ARRIVAL_TRACE    // Replayed from arrivalTrace
+};
+
+extern const char *arrivalNames[]; // Indexed by ArrivalProcess
+
+enum ServiceDistribution
+{
+    SERVICE_FIXED,
+    SERVICE_EXPONENTIAL,
+    SERVICE_LOGNORMAL
+};
+
+// How long one stage holds a patient. mean is in seconds; sigma is the shape of a lognormal
+// (standard deviation of its log), so the mean stays what was asked for whatever the spread
+struct ServiceTime
+{
+    ServiceDistribution distribution;
+    double mean;
+    double sigma;
+};
+
+// How a thread waits out a service time or an arrival gap on the monotonic clock
+enum ServiceTiming
+{
+    TIMING_SLEEP,  // Sleep to the absolute deadline. Late by the wake-up latency of the kernel
+    TIMING_SPIN,   // Busy-wait the whole time. Precise, but burns a CPU per waiting actor
+    TIMING_HYBRID  // Sleep until SPIN_MARGIN before the deadline, busy-wait the rest
+};
+
+extern const char *timingNames[]; // Indexed by ServiceTiming
+
+// What the thread engine's semaphores do when a wait finds them at zero
+enum SyncPrimitive
+{
+    SYNC_SEMAPHORE, // Park in the kernel right away, as a plain sem_t
+    SYNC_SPIN       // Poll for an adaptive while before parking (SpinSemaphore)
+};
+
+extern const char *syncNames[]; // Indexed by SyncPrimitive
+
+#define SPIN_MARGIN 50e-6 // Seconds TIMING_HYBRID busy-waits, about a worst case kernel wake-up
+
+struct ClinicConfig
+{
+    int numDoctors;
+    int numNurses;
+    int numPatients;
+    int numWorkers;       // Size of the worker pool that runs patient tasks
+    int numReceptionists; // Receptionists registering patients in parallel
+
+    AssignPolicy assignPolicy;
+    bool steal; // Idle nurses take waiting patients from siblings' rooms
+
+    int roomCapacity;        // Seats in each nurse's waiting room, at most MAX_ROOM_CAPACITY. 0 seats everyone
+    OverflowPolicy overflow; // What happens to a patient whose room is full
+
+    int admissionBatch;      // Patients a receptionist seats for one nurse before waking that nurse. 1 wakes per patient
+    double admissionTimeout; // Longest a seated patient goes unannounced to the nurse while a batch fills, in seconds
+
+    DispatchPolicy dispatchPolicy;
+    Placement placement;
+    bool processes; // Thread engine only: receptionists, nurses and doctors each in a process of their own, the clinic in shared memory
+
+    ClinicEngine engine;
+
+    ArrivalProcess arrivals;
+    double arrivalRate;         // Patients per second for ARRIVAL_POISSON
+    const double *arrivalTrace; // ARRIVAL_TRACE: seconds after opening each patient arrives, nondecreasing. Owned by the caller
+
+    ServiceTime receptionService; // Registering a patient
+    ServiceTime nurseService;     // Nurse taking patient to the doctor's office
+    ServiceTime doctorService;    // Doctor listening to symptoms
+    ServiceTiming timing;
+    SyncPrimitive sync;
+
+    uint64_t seed; // Every random draw derives from this, so one seed always makes the same choices
+
+    int triageShare[PRIORITY_COUNT];   // Percent of patients the receptionist puts in each class, summing to 100
+    int triageWeights[PRIORITY_COUNT]; // Nurses take from each class in proportion to these while all have patients waiting
+};
+
+struct Clinic;
+
+// Everything a nurse touches on the hot path, on its own cache lines
+struct alignas(CACHE_LINE) NurseState
+{
+    WaitingRoom room;                  // Waiting room of patients for this nurse
+    SpinSemaphore patientJoinWaitRoom; // Nurse takes a patient from waiting room. Receptionist posts when a patient joins wait room
+    SpinSemaphore seatFree;            // Free seats, with a room capacity. Receptionist takes one to seat a patient, nurse posts when taking one out
+
+    int patientsTaken;  // Count of patients this nurse took to a doctor
+    int patientsStolen; // How many of those came from a sibling's room
+    double waitTotal;   // Sum over those patients of time spent in a waiting room
+    double waitMax;     // Longest time one of those patients spent in a waiting room
+
+    Xoshiro256 random; // This nurse's own stream of the run seed
+
+    int id;
+    pthread_t thread;
+    Clinic *clinic;
+};
+
+// Everything a doctor touches on the hot path, on its own cache lines
+struct alignas(CACHE_LINE) DoctorState
+{
+    SpinSemaphore ready;          // Whether doctor is ready or not. For a pinned nurse to send in new patient
+    SpinSemaphore assigned;       // Nurse signals that a patient was sent in. Doctor sleeps on this between patients
+    SpinSemaphore patientSymptom; // Doctor listens to patient symptom
+    SpinSemaphore patientLeave;   // Doctor waits for patient to leave
+    int patientId;                // Current patient of doctor. -1 meaning no patient
+
+    int patientsSeen;  // Count of patients this doctor advised
+    double busySince;  // When the current patient was sent in
+    double busyTotal;  // Time spent with patients, from being sent in to the patient leaving
+
+    Xoshiro256 random; // This doctor's own stream of the run seed
+
+    int id;
+    pthread_t thread;
+    Clinic *clinic;
+};
+
+struct alignas(CACHE_LINE) ReceptionistState
+{
+    int patients;         // Count of patients this receptionist has registered
+    double firstRegister; // When this receptionist took its first patient
+    double lastRegister;  // When this receptionist finished its last patient
+
+    int roomSamples;           // Snapshots of all room lengths, one per registration
+    double roomLengthTotal;    // Sum of the mean room length over snapshots
+    double roomVarianceTotal;  // Sum of the variance of room lengths across nurses over snapshots
+
+    int patientsDiverted; // Patients seated in another room than the one assigned, which was full
+    int patientsShed;     // Patients turned away at a full room. Not counted in patients
+    double blockedTotal;  // Time spent waiting for a seat in a full room
+
+    int *unannounced;         // Array (Size = Nurses) - Patients this receptionist seated in each room but has not posted yet
+    int unannouncedTotal;     // Sum of unannounced
+    double oldestUnannounced; // When the first of those was seated
+
+    Xoshiro256 random; // This receptionist's own stream of the run seed
+
+    int id;
+    pthread_t thread;
+    Clinic *clinic;
+};
+
+// Phases of a patient's visit, each timed with the monotonic clock
+enum PatientPhase
+{
+    PHASE_RECEPTION_WAIT, // Entering until a receptionist picks patient up
+    PHASE_REGISTRATION,   // Receptionist picks patient up until patient sits in a waiting room
+    PHASE_WAITING_ROOM,   // Sitting until a nurse takes patient out, includes the nurse's wait for a doctor
+    PHASE_HANDOFF,        // Nurse takes patient out until patient enters the doctor's office
+    PHASE_CONSULTATION,   // Entering the office until patient leaves
+    PHASE_END_TO_END,     // Entering until patient leaves
+    PHASE_COUNT
+};
+
+extern const char *phaseNames[]; // Indexed by PatientPhase
+
+struct WorkerState
+{
+    int id;
+    pthread_t thread;
+    Clinic *clinic;
+};
+
+struct Clinic
+{
+    ClinicConfig config;
+
+    Arena arena; // Owns this object and every array below
+
+    // Patients - struct of arrays, one entry per patient
+    unsigned char *patientState; // Array (Size = Patients) - Next step each patient runs when scheduled
+    int *nurseOfPatient;         // Array (Size = Patients) - Assigned nurse of a patient. -1 for a patient turned away at a full room
+    int *doctorOfPatient;        // Array (Size = Patients) - Doctor the nurse sent patient to
+    double *arrivedAt;           // Array (Size = Patients) - When patient entered the clinic
+    double *phaseStartedAt;      // Array (Size = Patients) - When patient's current phase began
+    unsigned char *priorityOfPatient; // Array (Size = Patients) - Triage class given at registration
+
+    ReceptionistState *receptionists; // Array (Size = Receptionists)
+    NurseState *nurses;               // Array (Size = Nurses)
+    DoctorState *doctors;             // Array (Size = Doctors)
+    WorkerState *workers;             // Array (Size = Workers)
+
+    // Worker pool
+    alignas(CACHE_LINE) RunQueue runQueue; // Patients whose next step is ready to run. -1 tells a worker to exit
+    SpinSemaphore runQueueItems;           // Count of entries in run queue. Workers sleep on this
+
+    // Written by every worker once per patient, so on a line of its own. Per-staff totals live in each
+    // NurseState and DoctorState, which already own their lines, and are summed when a report needs them
+    alignas(CACHE_LINE) std::atomic<int> patientsInside; // Patients admitted and not yet left, plus one while the door is open
+    std::atomic<double> lastLeftAt;                      // Latest time a patient left, for a door that closes after the last one
+
+    alignas(CACHE_LINE) SpinSemaphore allPatientsLeft; // Posted once the door is closed and everyone inside left
+    double openedAt;                                   // When the first patient could arrive
+    double lastPatientLeftAt;                          // When the last patient left
+    int patientsAdmitted;                              // Count of patients let in so far. Only the front door writes it
+
+    // Receptionists
+    alignas(CACHE_LINE) AdmissionQueue admission; // Patients waiting for a receptionist, in arrival order. -1 tells a receptionist to leave
+    SpinSemaphore patientCheckIn;                 // Count of entries in admission. Receptionists sleep on this
+
+    // Shared doctor pool
+    alignas(CACHE_LINE) DoctorPool readyDoctors; // Ids of doctors waiting for a patient
+    SpinSemaphore doctorsReady;                  // Count of entries in readyDoctors. Nurses sleep on this
+
+    bool clinicClosing; // Set once every patient has left. Nurses and doctors exit when woken up with this set
+
+    Topology topology; // Read when threads are placed, empty otherwise. A shard's share of the machine when confined
+    bool confined;     // Keep every thread on topology's CPUs, even those the placement policy leaves alone
+
+    StatsHeader *stats; // Live counters for clinicstat, or NULL. Mapped by the caller before the run
+
+    LatencyHistogram phaseLatency[PHASE_COUNT]; // Nanoseconds each patient spent in each phase
+    LatencyHistogram timerLateness;             // Nanoseconds each timed wait overran its deadline
+
+    // Per triage class, to check urgent patients go first and the rest still get through
+    LatencyHistogram classWaitLatency[PRIORITY_COUNT];     // Nanoseconds in the waiting room
+    LatencyHistogram classEndToEndLatency[PRIORITY_COUNT]; // Nanoseconds from arrival to leaving
+};
+
+// ----- Live stats
+
+// Progress for the stats page, called by every engine where it counts the same thing. Nothing without a page
+
+inline void statsAdmitted(Clinic &clinic, int patientsAdmitted)
+{
+    if (clinic.stats != NULL)
+        clinic.stats->admitted.store(patientsAdmitted, std::memory_order_relaxed);
+}
+
+// Receptionist seated a patient in nurseId's room
+inline void statsSeated(Clinic &clinic, const ReceptionistState &receptionist, int nurseId)
+{
+    if (clinic.stats == NULL)
+        return;
+
+    statsReceptionists(clinic.stats)[receptionist.id].registered.store(receptionist.patients, std::memory_order_relaxed);
+    statsNurses(clinic.stats)[nurseId].seated.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Nurse took a patient out of roomNurseId's room, its own unless it stole
+inline void statsTaken(Clinic &clinic, const NurseState &nurse, int roomNurseId)
+{
+    if (clinic.stats == NULL)
+        return;
+
+    StatsNurse *nurses = statsNurses(clinic.stats);
+    nurses[roomNurseId].called.fetch_add(1, std::memory_order_relaxed);
+    nurses[nurse.id].taken.store(nurse.patientsTaken, std::memory_order_relaxed);
+}
+
+// Doctor had a patient sent in, or saw one out
+inline void statsDoctor(Clinic &clinic, const DoctorState &doctor, bool busy)
+{
+    if (clinic.stats == NULL)
+        return;
+
+    StatsDoctor &slot = statsDoctors(clinic.stats)[doctor.id];
+    slot.busy.store(busy, std::memory_order_relaxed);
+    slot.seen.store(doctor.patientsSeen, std::memory_order_relaxed);
+}
+
+// ----- Trace
+
+// Span of actor between two clinic times in seconds, for every engine. Nothing unless tracing
+inline void traceClinic(const Clinic &clinic, TraceTrack track, int actor, const char *name, int patientId, double start, double end)
+{
+    if (tracing)
+        traceAppend(track, actor, name, patientId, start > clinic.openedAt ? (uint64_t)((start - clinic.openedAt) * 1e9) : 0,
+                    end > start ? (uint64_t)((end - start) * 1e9) : 0);
+}
+
+// ----- Utils
+
+double timespecSeconds(const timespec &ts);
+double monotonicSeconds();
+double timevalSeconds(const timeval &tv);
+
+// getrusage of this process plus its children that have been waited for, so staff processes count too
+void processUsage(rusage &usage);
+
+// Streams of the run seed. Each actor and each patient draws from its own, so what it draws
+// does not depend on which thread ran it or in what order
+enum RandomStream
+{
+    STREAM_PATIENT,
+    STREAM_RECEPTIONIST,
+    STREAM_NURSE,
+    STREAM_DOCTOR,
+    STREAM_ARRIVAL,
+    STREAM_TRIAGE,
+    STREAM_ROUTE
+};
+
+uint64_t randomStream(RandomStream kind, int id);
+
+// The nurse ASSIGN_RANDOM gives patientId. Same seed, same nurse, whatever the engine
+int randomNurse(const ClinicConfig &config, int patientId);
+
+// The nurse config.assignPolicy gives patientId, for every engine. roomLength(nurseId) is how many patients
+// wait in that nurse's room, wherever the engine keeps it
+template <typename RoomLength>
+int assignNurse(const ClinicConfig &config, const ReceptionistState &receptionist, int patientId, RoomLength roomLength)
+{
+    int numNurses = config.numNurses;
+
+    if (config.assignPolicy == ASSIGN_RANDOM)
+        return randomNurse(config, patientId);
+
+    // Start the scan at a different nurse each time so ties don't all go to nurse 0
+    int start = (receptionist.patients + receptionist.id) % numNurses;
+    int bestNurseId = start;
+    size_t bestSize = roomLength(start);
+
+    for (int i = 1; i < numNurses && bestSize > 0; i++)
+    {
+        int nurseId = (start + i) % numNurses;
+        size_t size = roomLength(nurseId);
+
+        if (size < bestSize)
+        {
+            bestNurseId = nurseId;
+            bestSize = size;
+        }
+    }
+
+    return bestNurseId;
+}
+
+// A free seat for a patient assigned to nurseId, under config.overflow, for every engine. tryTakeSeat(nurseId)
+// takes a seat in that nurse's room if one is free. Returns the nurse whose room the seat is in, or -1 when
+// none was: the engine then blocks on nurseId's room or, under OVERFLOW_REJECT, turns the patient away
+template <typename TryTakeSeat>
+int findFreeSeat(const ClinicConfig &config, ReceptionistState &receptionist, int nurseId, TryTakeSeat tryTakeSeat)
+{
+    // Every seat is free without a capacity
+    if (config.roomCapacity == 0 || tryTakeSeat(nurseId))
+        return nurseId;
+
+    // The next room round from the assigned one, so diverted patients spread instead of piling on one nurse
+    for (int i = 1; config.overflow == OVERFLOW_DIVERT && i < config.numNurses; i++)
+    {
+        int otherNurseId = (nurseId + i) % config.numNurses;
+        if (tryTakeSeat(otherNurseId))
+        {
+            receptionist.patientsDiverted++;
+            return otherNurseId;
+        }
+    }
+
+    return -1;
+}
+
+// Mean and variance of room lengths across nurses, right after a registration. roomLength as for assignNurse
+template <typename RoomLength>
+void sampleRoomLengths(const ClinicConfig &config, ReceptionistState &receptionist, RoomLength roomLength)
+{
+    int numNurses = config.numNurses;
+    double sum = 0, sumSquares = 0;
+
+    for (int nurseId = 0; nurseId < numNurses; nurseId++)
+    {
+        double length = roomLength(nurseId);
+        sum += length;
+        sumSquares += length * length;
+    }
+
+    double mean = sum / numNurses;
+    receptionist.roomSamples++;
+    receptionist.roomLengthTotal += mean;
+    receptionist.roomVarianceTotal += sumSquares / numNurses - mean * mean;
+}
+
+// The class a receptionist gives patientId, drawn by config.triageShare. Same seed, same class, whatever the engine
+Priority randomPriority(const ClinicConfig &config, int patientId);
+
+// Record a patient's waiting room time or, at PHASE_END_TO_END, its whole visit under its triage class
+void recordClassLatency(Clinic &clinic, int patientId, PatientPhase phase, double seconds);
+
+// One draw of a service time, in seconds
+double sampleService(const ServiceTime &service, Xoshiro256 &random);
+
+// Seconds after opening that patientId arrives, given when the patient before arrived. Call in patient
+// order with one generator on STREAM_ARRIVAL, so every engine sees the same arrivals for a seed
+double nextArrival(const ClinicConfig &config, Xoshiro256 &random, int patientId, double previous);
+
+// Wait on the monotonic clock until deadline as config.timing says, and record how late it woke
+void waitUntil(Clinic &clinic, double deadline);
+
+// ----- Clinic
+
+// Allocate the arena and lay out every array for config. Threads only start in runClinic
+Clinic *createClinic(const ClinicConfig &config);
+
+// Open the clinic, let every patient through and join all threads. Call once per clinic
+void runClinic(Clinic &clinic);
+
+// runClinic for the threads engine in pieces, for a caller that lets patients in itself as the shard front
+// door does. openClinic starts every thread and opens the door, admitPatient lets one patient in at a time,
+// and finishClinic waits for everyone inside to leave once closeDoor was called, then joins every thread
+void openClinic(Clinic &clinic);
+
+// Let the next patient in, due to have arrived at arrivedAt. Returns its id in this clinic. At most
+// config.numPatients per clinic, from one thread
+int admitPatient(Clinic &clinic, double arrivedAt);
+
+void closeDoor(Clinic &clinic);
+void finishClinic(Clinic &clinic);
+
+// Patients admitted that have not left yet. A snapshot that workers keep changing
+int patientsWaiting(const Clinic &clinic);
+
+// runClinic for ENGINE_COROUTINES, in coro_clinic.cpp
+void runCoroutineClinic(Clinic &clinic);
+
+// runClinic for ENGINE_SIMULATION, in sim_clinic.cpp. Every time it records is virtual
+void runSimulatedClinic(Clinic &clinic);
+
+// Close the patient's current phase at now and start the next one. Returns the phase's length in seconds
+double endPhase(Clinic &clinic, int patientId, PatientPhase phase, double now);
+
+void destroyClinic(Clinic *clinic);
+
+// Reports, once runClinic returned
+void printMemoryFootprint(const Clinic *clinic);
+void printRegistrationReport(const Clinic *clinic);
+void printAssignmentReport(const Clinic *clinic);
+void printOverflowReport(const Clinic *clinic);
+void printDoctorReport(const Clinic *clinic);
+void printArrivalReport(const Clinic *clinic);
+void printTriageReport(const Clinic *clinic);
+void printLatencyReport(const Clinic *clinic);
+
+#endif
@@ -0,0 +1,154 @@
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <time.h>
+#include <stdio.h>
+
+#include "stats_page.h"
+
+// Watch a running clinic through the stats page project2 --stats maps, vmstat style: one line per
+// interval, the first with averages since the clinic opened. Stops after count lines, or once the
+// clinic closes
+
+// ----- Sampling
+
+struct Sample
+{
+    double at; // statsClock seconds
+    uint64_t admitted;
+    uint64_t registered;
+    uint64_t taken;
+    uint64_t seen;
+    std::vector<long> roomLengths; // Per nurse
+    std::string doctors;           // Per doctor, B busy or . idle
+    bool closed;
+};
+
+void takeSample(StatsHeader *page, Sample &sample)
+{
+    // Counters stop moving once the page is closed, so the interval ends there
+    sample.closed = page->state.load(std::memory_order_acquire) == STATS_CLOSED;
+    sample.at = sample.closed ? page->closedAt : statsClock();
+    sample.admitted = page->admitted.load(std::memory_order_relaxed);
+
+    sample.registered = 0;
+    for (int receptionistId = 0; receptionistId < page->numReceptionists; receptionistId++)
+        sample.registered += statsReceptionists(page)[receptionistId].registered.load(std::memory_order_relaxed);
+
+    sample.taken = 0;
+    sample.roomLengths.clear();
+    for (int nurseId = 0; nurseId < page->numNurses; nurseId++)
+    {
+        StatsNurse &nurse = statsNurses(page)[nurseId];
+        sample.taken += nurse.taken.load(std::memory_order_relaxed);
+
+        // Read called first: a patient seated after it only makes the room look longer, never negative
+        long called = nurse.called.load(std::memory_order_relaxed);
+        long seated = nurse.seated.load(std::memory_order_relaxed);
+        sample.roomLengths.push_back(seated > called ? seated - called : 0);
+    }
+
+    sample.seen = 0;
+    sample.doctors.clear();
+    for (int doctorId = 0; doctorId < page->numDoctors; doctorId++)
+    {
+        StatsDoctor &doctor = statsDoctors(page)[doctorId];
+        sample.seen += doctor.seen.load(std::memory_order_relaxed);
+        sample.doctors += doctor.busy.load(std::memory_order_relaxed) ? 'B' : '.';
+    }
+}
+
+void printHeader()
+{
+    printf("%10s %10s %10s %10s %9s %9s %9s %8s %5s  %s  %s\n", "admitted", "registered", "taken", "seen",
+           "reg/s", "take/s", "seen/s", "waiting", "busy", "rooms", "doctors");
+}
+
+void printSample(const Sample &previous, const Sample &sample)
+{
+    double elapsed = sample.at - previous.at;
+    if (elapsed <= 0)
+        elapsed = 1e-9;
+
+    long waiting = 0;
+    std::string rooms;
+    for (size_t nurseId = 0; nurseId < sample.roomLengths.size(); nurseId++)
+    {
+        waiting += sample.roomLengths[nurseId];
+        rooms += (nurseId == 0 ? "" : ",") + std::to_string(sample.roomLengths[nurseId]);
+    }
+
+    int busy = 0;
+    for (char doctor : sample.doctors)
+        busy += doctor == 'B';
+
+    printf("%10llu %10llu %10llu %10llu %9.0f %9.0f %9.0f %8ld %5d  %s  %s\n",
+           (unsigned long long)sample.admitted, (unsigned long long)sample.registered, (unsigned long long)sample.taken,
+           (unsigned long long)sample.seen,
+           (sample.registered - previous.registered) / elapsed, (sample.taken - previous.taken) / elapsed,
+           (sample.seen - previous.seen) / elapsed, waiting, busy, rooms.c_str(), sample.doctors.c_str());
+    fflush(stdout);
+}
+
+// ----- Main
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s <stats file> [interval seconds] [count]\n"
+                    "       Reads the page a clinic run with --stats <stats file> keeps up to date\n",
+            program);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 4)
+    {
+        usage(argv[0]);
+    }
+
+    double interval = argc > 2 ? atof(argv[2]) : 1;
+    long count = argc > 3 ? atol(argv[3]) : 0; // 0 runs until the clinic closes
+
+    if (interval <= 0 || count < 0)
+    {
+        usage(argv[0]);
+    }
+
+    StatsHeader *page = openStatsPage(argv[1]);
+    if (page == NULL)
+        exit(1);
+
+    printf("Clinic pid %d: %d patients, %d receptionists, %d nurses, %d doctors\n", page->pid, page->numPatients,
+           page->numReceptionists, page->numNurses, page->numDoctors);
+
+    // All zeros when the page was made, so the first line averages over the whole run so far
+    Sample previous;
+    previous.at = page->createdAt;
+    previous.admitted = previous.registered = previous.taken = previous.seen = 0;
+
+    timespec pause;
+    pause.tv_sec = (time_t)interval;
+    pause.tv_nsec = (long)((interval - pause.tv_sec) * 1e9);
+
+    for (long line = 0; count == 0 || line < count; line++)
+    {
+        if (line > 0)
+            nanosleep(&pause, NULL);
+
+        // A header every screenful, as vmstat does
+        if (line % 20 == 0)
+            printHeader();
+
+        Sample sample;
+        takeSample(page, sample);
+        printSample(previous, sample);
+        previous = sample;
+
+        if (sample.closed)
+            break;
+    }
+
+    unmapStatsPage(page);
+    return 0;
+}
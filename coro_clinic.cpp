@@ -0,0 +1,498 @@
+#include <cstdlib>
+#include <stdio.h>
+
+#include "clinic.h"
+#include "coroutine.h"
+#include "event_log.h"
+
+// Coroutine engine: every patient, receptionist, nurse and doctor is a coroutine, and each semaphore
+// of the thread engine is a CoSemaphore or CoQueue it awaits. All of them share the worker pool, so
+// handoffs between actors never go through the kernel unless a worker has nothing left to run.
+// Statistics land in the same Clinic fields as the thread engine, so every report works for both
+
+// ----- Coroutine clinic state
+
+// Awaitable counterparts of the thread engine's semaphores and queues
+struct CoDoctor
+{
+    CoSemaphore ready;          // Pinned dispatch: doctor is ready for its nurse's next patient
+    CoSemaphore assigned;       // Nurse sent in a patient. Doctor waits on this between patients
+    CoSemaphore patientSymptom; // Patient told symptoms
+    CoSemaphore patientLeave;   // Patient left the office
+};
+
+// A nurse's waiting room: one FIFO per triage class, taken from in TriagePicker order. With a capacity, a
+// patient only goes in on a seat taken with seat() or tryTakeSeat(), and take() frees it
+struct CoRoom
+{
+    void init(CoScheduler *scheduler, const ClinicConfig &config)
+    {
+        patients.init(scheduler, 0);
+        seats.init(scheduler, config.roomCapacity);
+        capacity = config.roomCapacity;
+        length.store(0, std::memory_order_relaxed);
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+        {
+            triage.weights[priority] = config.triageWeights[priority];
+            triage.credit[priority] = 0;
+        }
+    }
+
+    void push(int patientId, int priority)
+    {
+        protect.lock();
+        queues[priority].push_back(patientId);
+        length.store(length.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        protect.unlock();
+
+        patients.post();
+    }
+
+    // Waits for a patient: co_await room.available(), then take()
+    CoSemaphore::Awaiter available()
+    {
+        return patients.wait();
+    }
+
+    // Waits for a free seat: co_await room.seat(), then push()
+    CoSemaphore::Awaiter seat()
+    {
+        return seats.wait();
+    }
+
+    // A free seat if there is one. Always true without a capacity
+    bool tryTakeSeat()
+    {
+        return capacity == 0 || seats.tryWait();
+    }
+
+    // Only after available() resumed, which guarantees a patient is there
+    int take()
+    {
+        protect.lock();
+
+        bool waiting[PRIORITY_COUNT];
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+            waiting[priority] = !queues[priority].empty();
+
+        std::deque<int> &queue = queues[triage.pick(waiting)];
+        int patientId = queue.front();
+        queue.pop_front();
+        length.store(length.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+
+        protect.unlock();
+
+        if (capacity > 0)
+            seats.post();
+        return patientId;
+    }
+
+    // Snapshot, safe from any thread
+    unsigned size() const
+    {
+        return length.load(std::memory_order_relaxed);
+    }
+
+private:
+    CoSpinLock protect;
+    std::deque<int> queues[PRIORITY_COUNT];
+    TriagePicker triage;
+    CoSemaphore patients;
+    CoSemaphore seats; // Free seats, with a capacity
+    int capacity;      // 0 for none
+    std::atomic<unsigned> length;
+};
+
+struct CoClinic
+{
+    Clinic *clinic;
+    CoScheduler scheduler;
+    CoTimer timer; // Service times, so a busy actor holds no worker
+
+    CoQueue<int> admission; // Patients waiting for a receptionist. -1 tells a receptionist to leave
+    CoRoom *rooms;          // Array (Size = Nurses) - Waiting room of each nurse. Woken up with clinicClosing set, the nurse leaves
+    CoQueue<int> readyDoctors;
+    CoDoctor *doctors;      // Array (Size = Doctors)
+    CoSemaphore *turns;     // Array (Size = Patients) - Staff posts when it is the patient's turn to move on
+
+    std::atomic<int> patientsLeft;
+    std::atomic<int> staffLeft;
+    sem_t allPatientsLeft; // Posted once the last patient leaves. Main thread sleeps on this
+    sem_t allStaffLeft;    // Posted once the last staff coroutine returns
+};
+
+// ----- Coroutines
+
+// Count a patient out. The last one wakes the main thread
+void coLeaveClinic(CoClinic &coClinic, double leftAt)
+{
+    Clinic &clinic = *coClinic.clinic;
+
+    if (coClinic.patientsLeft.fetch_add(1) + 1 == clinic.config.numPatients)
+    {
+        clinic.lastPatientLeftAt = leftAt;
+        sem_post(&coClinic.allPatientsLeft);
+    }
+}
+
+CoTask patientCoroutine(CoClinic &coClinic, int patientId)
+{
+    Clinic &clinic = *coClinic.clinic;
+
+    // --- Register phase
+
+    logEvent(EV_PATIENT_ENTERS, patientId);
+
+    coClinic.admission.push(patientId);
+
+    // --- Nurse phase: wait until nurse takes patient to doctor's office
+
+    co_await coClinic.turns[patientId].wait();
+
+    // Turned away at a full room, when the receptionist was done with the patient
+    if (clinic.nurseOfPatient[patientId] == -1)
+    {
+        coLeaveClinic(coClinic, clinic.phaseStartedAt[patientId]);
+        co_return;
+    }
+
+    // --- Doctor phase
+
+    int assignedDoctorId = clinic.doctorOfPatient[patientId];
+    CoDoctor &doctor = coClinic.doctors[assignedDoctorId];
+
+    endPhase(clinic, patientId, PHASE_HANDOFF, monotonicSeconds());
+
+    logEvent(EV_PATIENT_IN_OFFICE, patientId, assignedDoctorId);
+
+    doctor.patientSymptom.post();
+
+    // Wait for advice
+    co_await coClinic.turns[patientId].wait();
+
+    logEvent(EV_PATIENT_ADVISED, patientId, assignedDoctorId);
+
+    doctor.patientLeave.post();
+
+    // --- Leave phase
+
+    logEvent(EV_PATIENT_LEAVES, patientId);
+
+    double leftAt = monotonicSeconds();
+    endPhase(clinic, patientId, PHASE_CONSULTATION, leftAt);
+    clinic.phaseLatency[PHASE_END_TO_END].record((uint64_t)((leftAt - clinic.arrivedAt[patientId]) * 1e9));
+    recordClassLatency(clinic, patientId, PHASE_END_TO_END, leftAt - clinic.arrivedAt[patientId]);
+
+    coLeaveClinic(coClinic, leftAt);
+}
+
+// Deadline of one draw of service counted from since, or 0 when the stage takes no time
+double coServiceDeadline(const ServiceTime &service, Xoshiro256 &random, double since)
+{
+    return service.mean > 0 ? since + sampleService(service, random) : 0;
+}
+
+void staffLeaves(CoClinic &coClinic)
+{
+    const ClinicConfig &config = coClinic.clinic->config;
+
+    if (coClinic.staffLeft.fetch_add(1) + 1 == config.numReceptionists + config.numNurses + config.numDoctors)
+        sem_post(&coClinic.allStaffLeft);
+}
+
+CoTask receptionistCoroutine(CoClinic &coClinic, ReceptionistState &receptionist)
+{
+    Clinic &clinic = *coClinic.clinic;
+
+    while (true)
+    {
+        // Wait for a patient to check in
+        co_await coClinic.admission.available();
+        int patientId = coClinic.admission.take();
+
+        if (patientId == -1)
+            break;
+
+        double registerStart = monotonicSeconds();
+        endPhase(clinic, patientId, PHASE_RECEPTION_WAIT, registerStart);
+        if (receptionist.patients == 0)
+            receptionist.firstRegister = registerStart;
+
+        logEvent(EV_RECEPTIONIST_RECEIVES, receptionist.id, patientId);
+
+        double registeredAt = coServiceDeadline(clinic.config.receptionService, receptionist.random, registerStart);
+        if (registeredAt > 0)
+            clinic.timerLateness.record((uint64_t)(co_await coClinic.timer.sleepUntil(registeredAt) * 1e9));
+
+        int assignedNurseId = assignNurse(clinic.config, receptionist, patientId, [&](int room) { return coClinic.rooms[room].size(); });
+        int nurseId = findFreeSeat(clinic.config, receptionist, assignedNurseId, [&](int room) { return coClinic.rooms[room].tryTakeSeat(); });
+
+        // No free seat to be had: wait for one in the assigned room, unless the patient is turned away
+        if (nurseId == -1 && clinic.config.overflow != OVERFLOW_REJECT)
+        {
+            double blockedSince = monotonicSeconds();
+            co_await coClinic.rooms[assignedNurseId].seat();
+            receptionist.blockedTotal += monotonicSeconds() - blockedSince;
+            nurseId = assignedNurseId;
+        }
+        clinic.nurseOfPatient[patientId] = nurseId;
+
+        Priority priority = randomPriority(clinic.config, patientId);
+        clinic.priorityOfPatient[patientId] = priority;
+
+        // Room full: the patient leaves without seeing a doctor
+        if (nurseId == -1)
+        {
+            logEvent(EV_PATIENT_TURNED_AWAY, patientId, assignedNurseId);
+
+            double leftAt = monotonicSeconds();
+            endPhase(clinic, patientId, PHASE_REGISTRATION, leftAt);
+            traceClinic(clinic, TRACK_RECEPTIONIST, receptionist.id, "registration", patientId, registerStart, leftAt);
+            receptionist.patientsShed++;
+
+            coClinic.turns[patientId].post();
+            continue;
+        }
+
+        // Registration done. Patient leaves the receptionist for the nurse's waiting room
+        logEvent(EV_PATIENT_SITS, patientId);
+
+        // The nurse reads the phase start only after taking the patient out of the room
+        double joinedRoomAt = monotonicSeconds();
+        endPhase(clinic, patientId, PHASE_REGISTRATION, joinedRoomAt);
+        traceClinic(clinic, TRACK_RECEPTIONIST, receptionist.id, "registration", patientId, registerStart, joinedRoomAt);
+
+        receptionist.patients++;
+        receptionist.lastRegister = joinedRoomAt;
+        statsSeated(clinic, receptionist, nurseId);
+
+        coClinic.rooms[nurseId].push(patientId, priority);
+
+        sampleRoomLengths(clinic.config, receptionist, [&](int room) { return coClinic.rooms[room].size(); });
+    }
+
+    staffLeaves(coClinic);
+}
+
+CoTask nurseCoroutine(CoClinic &coClinic, NurseState &nurse)
+{
+    Clinic &clinic = *coClinic.clinic;
+    CoRoom &room = coClinic.rooms[nurse.id];
+
+    while (true)
+    {
+        // Wait for a patient in the waiting room or the clinic to close
+        co_await room.available();
+
+        if (clinic.clinicClosing)
+            break;
+
+        // Wait for a doctor to ready
+        int doctorId;
+        if (clinic.config.dispatchPolicy == DISPATCH_PINNED)
+        {
+            doctorId = nurse.id % clinic.config.numDoctors;
+            co_await coClinic.doctors[doctorId].ready.wait();
+        }
+        else
+        {
+            co_await coClinic.readyDoctors.available();
+            doctorId = coClinic.readyDoctors.take();
+        }
+
+        DoctorState &doctor = clinic.doctors[doctorId];
+
+        // Take patient out of wait room. The wake-up above guarantees one is there
+        int patientId = room.take();
+
+        logEvent(EV_NURSE_TAKES, nurse.id, patientId);
+
+        double takenAt = monotonicSeconds();
+        double wait = endPhase(clinic, patientId, PHASE_WAITING_ROOM, takenAt);
+        nurse.patientsTaken++;
+        nurse.waitTotal += wait;
+        if (wait > nurse.waitMax)
+            nurse.waitMax = wait;
+        statsTaken(clinic, nurse, nurse.id);
+
+        doctor.patientId = patientId;
+        clinic.doctorOfPatient[patientId] = doctorId;
+
+        // Wake up doctor for the new patient, then walk the patient in
+        coClinic.doctors[doctorId].assigned.post();
+
+        double inOfficeAt = coServiceDeadline(clinic.config.nurseService, nurse.random, takenAt);
+        if (inOfficeAt > 0)
+            clinic.timerLateness.record((uint64_t)(co_await coClinic.timer.sleepUntil(inOfficeAt) * 1e9));
+        traceClinic(clinic, TRACK_NURSE, nurse.id, "escort", patientId, takenAt, inOfficeAt > 0 ? inOfficeAt : takenAt);
+
+        coClinic.turns[patientId].post();
+    }
+
+    staffLeaves(coClinic);
+}
+
+void coReadyDoctor(CoClinic &coClinic, DoctorState &doctor)
+{
+    if (coClinic.clinic->config.dispatchPolicy == DISPATCH_PINNED)
+        coClinic.doctors[doctor.id].ready.post();
+    else
+        coClinic.readyDoctors.push(doctor.id);
+}
+
+CoTask doctorCoroutine(CoClinic &coClinic, DoctorState &doctor)
+{
+    Clinic &clinic = *coClinic.clinic;
+    CoDoctor &coDoctor = coClinic.doctors[doctor.id];
+
+    while (true)
+    {
+        // Wait until nurse sends in a patient or the clinic closes
+        co_await coDoctor.assigned.wait();
+
+        if (clinic.clinicClosing)
+            break;
+
+        doctor.busySince = monotonicSeconds();
+        statsDoctor(clinic, doctor, true);
+
+        int patientId = doctor.patientId;
+
+        // Wait for current patient to tell symptoms
+        co_await coDoctor.patientSymptom.wait();
+
+        logEvent(EV_DOCTOR_LISTENS, doctor.id, patientId);
+
+        double advisedAt = coServiceDeadline(clinic.config.doctorService, doctor.random, monotonicSeconds());
+        if (advisedAt > 0)
+            clinic.timerLateness.record((uint64_t)(co_await coClinic.timer.sleepUntil(advisedAt) * 1e9));
+
+        // Give advice to patient
+        coClinic.turns[patientId].post();
+
+        // Wait for patient to leave
+        co_await coDoctor.patientLeave.wait();
+
+        double freeAt = monotonicSeconds();
+        doctor.patientId = -1;
+        doctor.patientsSeen++;
+        doctor.busyTotal += freeAt - doctor.busySince;
+        statsDoctor(clinic, doctor, false);
+        traceClinic(clinic, TRACK_DOCTOR, doctor.id, "consultation", patientId, doctor.busySince, freeAt);
+
+        coReadyDoctor(coClinic, doctor);
+    }
+
+    staffLeaves(coClinic);
+}
+
+// ----- Engine
+
+void runCoroutineClinic(Clinic &clinic)
+{
+    const ClinicConfig &config = clinic.config;
+
+    CoClinic *coClinic = new CoClinic();
+    coClinic->clinic = &clinic;
+    coClinic->rooms = new CoRoom[config.numNurses];
+    coClinic->doctors = new CoDoctor[config.numDoctors];
+    coClinic->turns = new CoSemaphore[config.numPatients];
+    sem_init(&coClinic->allPatientsLeft, 0, 0);
+    sem_init(&coClinic->allStaffLeft, 0, 0);
+
+    CoScheduler *scheduler = &coClinic->scheduler;
+
+    coClinic->admission.init(scheduler);
+    coClinic->readyDoctors.init(scheduler);
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+        coClinic->rooms[nurseId].init(scheduler, config);
+    for (int doctorId = 0; doctorId < config.numDoctors; doctorId++)
+    {
+        coClinic->doctors[doctorId].ready.init(scheduler, 0);
+        coClinic->doctors[doctorId].assigned.init(scheduler, 0);
+        coClinic->doctors[doctorId].patientSymptom.init(scheduler, 0);
+        coClinic->doctors[doctorId].patientLeave.init(scheduler, 0);
+    }
+    for (int patientId = 0; patientId < config.numPatients; patientId++)
+        coClinic->turns[patientId].init(scheduler, 0);
+
+    scheduler->start(config.numWorkers);
+
+    double spinMargin = config.timing == TIMING_SLEEP ? 0 : config.timing == TIMING_HYBRID ? SPIN_MARGIN : 1e9;
+    coClinic->timer.start(scheduler, spinMargin);
+
+    clinic.openedAt = monotonicSeconds();
+
+    // Staff first, in the same order as the thread engine, then patients as they arrive
+    for (int receptionistId = 0; receptionistId < config.numReceptionists; receptionistId++)
+    {
+        ReceptionistState &receptionist = clinic.receptionists[receptionistId];
+        receptionist.id = receptionistId;
+        receptionist.clinic = &clinic;
+        scheduler->schedule(receptionistCoroutine(*coClinic, receptionist).handle);
+    }
+
+    for (int doctorId = 0; doctorId < config.numDoctors; doctorId++)
+    {
+        DoctorState &doctor = clinic.doctors[doctorId];
+        doctor.id = doctorId;
+        doctor.clinic = &clinic;
+        doctor.patientId = -1;
+
+        // Every doctor starts out ready
+        coReadyDoctor(*coClinic, doctor);
+        scheduler->schedule(doctorCoroutine(*coClinic, doctor).handle);
+    }
+
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+    {
+        NurseState &nurse = clinic.nurses[nurseId];
+        nurse.id = nurseId;
+        nurse.clinic = &clinic;
+        scheduler->schedule(nurseCoroutine(*coClinic, nurse).handle);
+    }
+
+    // Arrivals are paced on this thread, exactly as in the thread engine
+    Xoshiro256 arrivalRandom;
+    arrivalRandom.seed(config.seed, randomStream(STREAM_ARRIVAL, 0));
+    double arrival = 0;
+
+    for (int patientId = 0; patientId < config.numPatients; patientId++)
+    {
+        arrival = nextArrival(config, arrivalRandom, patientId, arrival);
+        if (config.arrivals != ARRIVAL_BATCH)
+            waitUntil(clinic, clinic.openedAt + arrival);
+
+        clinic.arrivedAt[patientId] = clinic.openedAt + arrival;
+        clinic.phaseStartedAt[patientId] = clinic.arrivedAt[patientId];
+        statsAdmitted(clinic, patientId + 1);
+
+        scheduler->schedule(patientCoroutine(*coClinic, patientId).handle);
+    }
+
+    while (sem_wait(&coClinic->allPatientsLeft) == -1)
+        ;
+
+    // Every staff coroutine is idle and waiting, wake each one up to leave
+    clinic.clinicClosing = true;
+
+    for (int receptionistId = 0; receptionistId < config.numReceptionists; receptionistId++)
+        coClinic->admission.push(-1);
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+        coClinic->rooms[nurseId].push(-1, PRIORITY_STANDARD);
+    for (int doctorId = 0; doctorId < config.numDoctors; doctorId++)
+        coClinic->doctors[doctorId].assigned.post();
+
+    while (sem_wait(&coClinic->allStaffLeft) == -1)
+        ;
+
+    coClinic->timer.stop();
+    scheduler->stop();
+
+    sem_destroy(&coClinic->allPatientsLeft);
+    sem_destroy(&coClinic->allStaffLeft);
+    delete[] coClinic->turns;
+    delete[] coClinic->doctors;
+    delete[] coClinic->rooms;
+    delete coClinic;
+}
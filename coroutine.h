@@ -0,0 +1,506 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/prctl.h>
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <queue>
+#include <vector>
+
+// Building blocks for running actors as C++20 coroutines, M:N on a small pool of worker threads.
+// A coroutine that has to wait parks itself in a CoSemaphore and costs no thread while it waits;
+// a post hands it back to the scheduler, so a handoff is a queue push instead of a kernel context switch.
+
+// Short critical sections only. Yields instead of spinning so a preempted holder gets to finish
+class CoSpinLock
+{
+public:
+    void lock()
+    {
+        while (held.exchange(true, std::memory_order_acquire))
+            sched_yield();
+    }
+
+    void unlock()
+    {
+        held.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> held{false};
+};
+
+// Worker threads taking ready coroutines from one FIFO. Idle workers sleep on a semaphore
+class CoScheduler
+{
+public:
+    void start(int numWorkers)
+    {
+        idleWorkers = 0;
+        stopping = false;
+        sem_init(&wake, 0, 0);
+
+        workers.resize(numWorkers);
+        for (int workerId = 0; workerId < numWorkers; workerId++)
+        {
+            int errcode = pthread_create(&workers[workerId], NULL, workerThread, this);
+            if (errcode)
+            {
+                fprintf(stderr, "pthread_create: %s\n", strerror(errcode));
+                exit(1);
+            }
+        }
+    }
+
+    // Resume handle on some worker, after every coroutine scheduled before it
+    void schedule(std::coroutine_handle<> handle)
+    {
+        protect.lock();
+        ready.push_back(handle);
+        bool wakeOne = idleWorkers > 0;
+        if (wakeOne)
+            idleWorkers--;
+        protect.unlock();
+
+        if (wakeOne)
+            sem_post(&wake);
+    }
+
+    // Only once every coroutine has finished. Joins the workers
+    void stop()
+    {
+        protect.lock();
+        stopping = true;
+        int sleepers = idleWorkers;
+        idleWorkers = 0;
+        protect.unlock();
+
+        for (int i = 0; i < sleepers; i++)
+            sem_post(&wake);
+
+        for (pthread_t worker : workers)
+        {
+            int errcode = pthread_join(worker, NULL);
+            if (errcode)
+            {
+                fprintf(stderr, "pthread_join: %s\n", strerror(errcode));
+                exit(1);
+            }
+        }
+
+        workers.clear();
+        sem_destroy(&wake);
+    }
+
+private:
+    static void *workerThread(void *arg)
+    {
+        CoScheduler &scheduler = *(CoScheduler *)arg;
+
+        std::coroutine_handle<> handle;
+        while (scheduler.next(handle))
+            handle.resume();
+
+        return arg;
+    }
+
+    // Sleep until a coroutine is ready. False once stopping and nothing is left
+    bool next(std::coroutine_handle<> &handle)
+    {
+        protect.lock();
+
+        while (ready.empty())
+        {
+            if (stopping)
+            {
+                protect.unlock();
+                return false;
+            }
+
+            // A scheduler that sees this count posts wake exactly once for it
+            idleWorkers++;
+            protect.unlock();
+            sem_wait(&wake);
+            protect.lock();
+        }
+
+        handle = ready.front();
+        ready.pop_front();
+        protect.unlock();
+        return true;
+    }
+
+    CoSpinLock protect; // Protection for everything below since every worker and poster touches it
+    std::deque<std::coroutine_handle<>> ready;
+    int idleWorkers; // Workers asleep on wake that no poster has claimed yet
+    bool stopping;
+
+    sem_t wake;
+    std::vector<pthread_t> workers;
+};
+
+// Counting semaphore whose wait is an awaitable. Waiters queue in FIFO order through nodes that live in
+// their own suspended frames, so waiting never allocates
+class CoSemaphore
+{
+public:
+    struct Awaiter
+    {
+        CoSemaphore &semaphore;
+        std::coroutine_handle<> handle;
+        Awaiter *next;
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        // Returning false resumes right away: a unit was available
+        bool await_suspend(std::coroutine_handle<> waiter)
+        {
+            semaphore.protect.lock();
+
+            if (semaphore.count > 0)
+            {
+                semaphore.count--;
+                semaphore.protect.unlock();
+                return false;
+            }
+
+            handle = waiter;
+            next = NULL;
+            if (semaphore.tail == NULL)
+                semaphore.head = this;
+            else
+                semaphore.tail->next = this;
+            semaphore.tail = this;
+
+            // Another worker may resume this coroutine as soon as the lock is released. Nothing below touches the frame
+            semaphore.protect.unlock();
+            return true;
+        }
+
+        void await_resume()
+        {
+        }
+    };
+
+    void init(CoScheduler *owner, int value)
+    {
+        scheduler = owner;
+        count = value;
+        head = NULL;
+        tail = NULL;
+    }
+
+    Awaiter wait()
+    {
+        return Awaiter{*this, NULL, NULL};
+    }
+
+    // Take a unit only if one is there. True when it took one
+    bool tryWait()
+    {
+        protect.lock();
+        bool taken = count > 0;
+        if (taken)
+            count--;
+        protect.unlock();
+        return taken;
+    }
+
+    // Hand one unit to the oldest waiter, or keep it for the next wait
+    void post()
+    {
+        protect.lock();
+
+        Awaiter *waiter = head;
+        if (waiter == NULL)
+        {
+            count++;
+            protect.unlock();
+            return;
+        }
+
+        head = waiter->next;
+        if (head == NULL)
+            tail = NULL;
+        std::coroutine_handle<> handle = waiter->handle;
+        protect.unlock();
+
+        scheduler->schedule(handle);
+    }
+
+private:
+    CoSpinLock protect;
+    int count;
+    Awaiter *head; // Oldest waiter
+    Awaiter *tail;
+    CoScheduler *scheduler;
+};
+
+// Unbounded FIFO whose pop is an awaitable, so producers never wait on consumers
+template <typename T>
+class CoQueue
+{
+public:
+    void init(CoScheduler *scheduler)
+    {
+        items.init(scheduler, 0);
+        length.store(0, std::memory_order_relaxed);
+    }
+
+    void push(const T &item)
+    {
+        protect.lock();
+        queue.push_back(item);
+        length.store(queue.size(), std::memory_order_relaxed);
+        protect.unlock();
+
+        items.post();
+    }
+
+    // Waits for an item: co_await queue.available(), then take()
+    CoSemaphore::Awaiter available()
+    {
+        return items.wait();
+    }
+
+    // Only after available() resumed, which guarantees an item is there
+    T take()
+    {
+        protect.lock();
+        T item = queue.front();
+        queue.pop_front();
+        length.store(queue.size(), std::memory_order_relaxed);
+        protect.unlock();
+
+        return item;
+    }
+
+    // Snapshot, safe from any thread
+    unsigned size() const
+    {
+        return length.load(std::memory_order_relaxed);
+    }
+
+private:
+    CoSpinLock protect;
+    std::deque<T> queue;
+    CoSemaphore items;
+    std::atomic<unsigned> length;
+};
+
+// Resumes coroutines at deadlines on the monotonic clock, all from one timer thread, so a coroutine
+// waiting out a service time holds no worker. The thread sleeps to the earliest deadline less spinMargin,
+// busy-waits the rest, and is woken early whenever a sooner deadline comes in
+class CoTimer
+{
+public:
+    struct Awaiter
+    {
+        CoTimer &timer;
+        double deadline;
+
+        bool await_ready()
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> waiter)
+        {
+            timer.add(deadline, waiter);
+        }
+
+        // Seconds the coroutine resumed after its deadline
+        double await_resume()
+        {
+            return nowSeconds() - deadline;
+        }
+    };
+
+    // spinMargin 0 only sleeps, a margin longer than any wait only spins
+    void start(CoScheduler *owner, double margin)
+    {
+        scheduler = owner;
+        spinMargin = margin;
+        nextSequence = 0;
+        stopping = false;
+        sem_init(&wake, 0, 0);
+
+        int errcode = pthread_create(&thread, NULL, timerThread, this);
+        if (errcode)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(errcode));
+            exit(1);
+        }
+    }
+
+    // Deadline in monotonic seconds
+    Awaiter sleepUntil(double deadline)
+    {
+        return Awaiter{*this, deadline};
+    }
+
+    // Only once no coroutine sleeps on the timer. Joins the timer thread
+    void stop()
+    {
+        protect.lock();
+        stopping = true;
+        protect.unlock();
+        sem_post(&wake);
+
+        int errcode = pthread_join(thread, NULL);
+        if (errcode)
+        {
+            fprintf(stderr, "pthread_join: %s\n", strerror(errcode));
+            exit(1);
+        }
+
+        sem_destroy(&wake);
+    }
+
+    static double nowSeconds()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+
+private:
+    struct Sleeper
+    {
+        double deadline;
+        unsigned long long sequence; // Sleepers with the same deadline resume in the order they came
+        std::coroutine_handle<> handle;
+    };
+
+    // Min-heap order for std::priority_queue
+    struct SleeperLater
+    {
+        bool operator()(const Sleeper &a, const Sleeper &b) const
+        {
+            if (a.deadline != b.deadline)
+                return a.deadline > b.deadline;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    void add(double deadline, std::coroutine_handle<> handle)
+    {
+        protect.lock();
+        sleepers.push(Sleeper{deadline, nextSequence++, handle});
+        bool soonest = sleepers.top().handle == handle;
+        protect.unlock();
+
+        if (soonest)
+            sem_post(&wake);
+    }
+
+    static void *timerThread(void *arg)
+    {
+        CoTimer &timer = *(CoTimer *)arg;
+
+        // The default timer slack lets the kernel wake this thread up to 50 us late
+        prctl(PR_SET_TIMERSLACK, 1);
+
+        while (true)
+        {
+            timer.protect.lock();
+
+            if (timer.sleepers.empty())
+            {
+                bool stopping = timer.stopping;
+                timer.protect.unlock();
+                if (stopping)
+                    break;
+
+                while (sem_wait(&timer.wake) == -1)
+                    ;
+                continue;
+            }
+
+            double deadline = timer.sleepers.top().deadline;
+            double now = nowSeconds();
+
+            if (now >= deadline)
+            {
+                std::coroutine_handle<> handle = timer.sleepers.top().handle;
+                timer.sleepers.pop();
+                timer.protect.unlock();
+
+                timer.scheduler->schedule(handle);
+                continue;
+            }
+
+            timer.protect.unlock();
+
+            // Inside the margin, go round again: a busy-wait that still sees sooner deadlines
+            double wakeAt = deadline - timer.spinMargin;
+            if (now < wakeAt)
+            {
+                timespec ts;
+                ts.tv_sec = (time_t)wakeAt;
+                ts.tv_nsec = (long)((wakeAt - ts.tv_sec) * 1e9);
+                sem_clockwait(&timer.wake, CLOCK_MONOTONIC, &ts);
+            }
+        }
+
+        return arg;
+    }
+
+    CoSpinLock protect; // Protection for everything below since the timer thread and every sleeper touch it
+    std::priority_queue<Sleeper, std::vector<Sleeper>, SleeperLater> sleepers;
+    unsigned long long nextSequence;
+    bool stopping;
+
+    sem_t wake; // Posted when a deadline sooner than all others comes in, and on stop
+    pthread_t thread;
+    CoScheduler *scheduler;
+    double spinMargin;
+};
+
+// Fire-and-forget coroutine. Starts suspended so the caller decides where it first runs, and frees its frame when it returns
+struct CoTask
+{
+    struct promise_type
+    {
+        CoTask get_return_object()
+        {
+            return CoTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include <cstring>
+#include <cstdlib>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sched.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+#include "event_log.h"
+#include "spsc_ring.h"
+
+#define errexit(code, str)                              \
+    fprintf(stderr, "%s: %s\n", (str), strerror(code)); \
+    exit(1);
+
+#define LOG_BUFFER_CAPACITY 16384 // Records per thread before the thread has to wait for the drainer
+#define DRAIN_INTERVAL_NS 1000000
+
+#define NOT_STAMPING UINT64_MAX
+
+static const char *eventFormats[EV_COUNT] = {
+    "Patient %d enters waiting room, waits for receptionist\n",
+    "Receptionist %d receives patient %d\n",
+    "Patient %d leaves receptionist and sits in waiting room\n",
+    "Patient %d is turned away, nurse %d's waiting room is full\n",
+    "Nurse %d takes patient %d over from nurse %d\n",
+    "Nurse %d takes patient %d to doctor's office\n",
+    "Patient %d enters doctor %d's office\n",
+    "Doctor %d listens to symptoms from patient %d\n",
+    "Patient %d receives advice from doctor %d\n",
+    "Patient %d leaves\n",
+};
+
+// One per logging thread. The thread is the only producer, the drainer the only consumer
+struct LogBuffer
+{
+    SpscRing<EventRecord> ring;
+    EventRecord storage[LOG_BUFFER_CAPACITY];
+
+    // Timestamp of the record this thread is about to publish, 0 while it is still reading the clock,
+    // NOT_STAMPING otherwise. Lets the drainer know no record older than this can still show up
+    alignas(64) std::atomic<uint64_t> stamping;
+};
+
+LogMode logMode = LOG_SILENT;
+
+static FILE *logOut;
+
+static sem_t buffersProtect;         // Protection for buffers since threads register while the drainer reads it
+static std::vector<LogBuffer *> buffers;
+static int generation = 0;           // Bumped by every logStart, so threads from an earlier run register again
+
+static thread_local LogBuffer *threadBuffer = NULL;
+static thread_local int threadGeneration = -1;
+
+static pthread_t drainer;
+static std::atomic<bool> draining;
+
+static uint64_t nowNanoseconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static LogBuffer *registerThread()
+{
+    LogBuffer *buffer = new LogBuffer();
+    buffer->ring.init(buffer->storage, LOG_BUFFER_CAPACITY);
+    buffer->stamping.store(NOT_STAMPING);
+
+    sem_wait(&buffersProtect);
+    buffers.push_back(buffer);
+    sem_post(&buffersProtect);
+
+    threadBuffer = buffer;
+    threadGeneration = generation;
+    return buffer;
+}
+
+void logAppend(ClinicEvent event, int actor, int arg0, int arg1)
+{
+    LogBuffer *buffer = threadGeneration == generation ? threadBuffer : registerThread();
+
+    // Announce before reading the clock, so a drainer that misses the announcement knows the timestamp is newer than its own
+    buffer->stamping.store(0, std::memory_order_seq_cst);
+
+    EventRecord record;
+    record.timestamp = nowNanoseconds();
+    record.event = event;
+    record.reserved = 0;
+    record.actor = actor;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+
+    buffer->stamping.store(record.timestamp, std::memory_order_release);
+
+    // Only full when the drainer is far behind, so give it a chance to catch up
+    while (!buffer->ring.push(record))
+        sched_yield();
+
+    buffer->stamping.store(NOT_STAMPING, std::memory_order_release);
+}
+
+static void writeRecord(const EventRecord &record)
+{
+    if (logMode == LOG_BINARY)
+        fwrite(&record, sizeof(EventRecord), 1, logOut);
+    else
+        fprintf(logOut, eventFormats[record.event], record.actor, record.args[0], record.args[1]);
+}
+
+// Write, in timestamp order, every buffered record older than the watermark: no thread can still
+// publish a record older than that. Each ring is already in timestamp order, so this is a merge
+static void drainOnce(bool final)
+{
+    uint64_t watermark = final ? NOT_STAMPING : nowNanoseconds();
+
+    sem_wait(&buffersProtect);
+    std::vector<LogBuffer *> snapshot = buffers;
+    sem_post(&buffersProtect);
+
+    for (size_t i = 0; i < snapshot.size(); i++)
+    {
+        uint64_t stamping = snapshot[i]->stamping.load(std::memory_order_seq_cst);
+        while (stamping == 0)
+            stamping = snapshot[i]->stamping.load(std::memory_order_seq_cst);
+
+        if (stamping < watermark)
+            watermark = stamping;
+    }
+
+    while (true)
+    {
+        LogBuffer *oldest = NULL;
+        EventRecord oldestRecord;
+        EventRecord record;
+
+        for (size_t i = 0; i < snapshot.size(); i++)
+        {
+            if (snapshot[i]->ring.peek(record) && (oldest == NULL || record.timestamp < oldestRecord.timestamp))
+            {
+                oldest = snapshot[i];
+                oldestRecord = record;
+            }
+        }
+
+        if (oldest == NULL || (!final && oldestRecord.timestamp >= watermark))
+            break;
+
+        writeRecord(oldestRecord);
+        oldest->ring.pop(record);
+    }
+}
+
+static void *drainerThread(void *arg)
+{
+    timespec interval = {0, DRAIN_INTERVAL_NS};
+
+    while (draining.load(std::memory_order_acquire))
+    {
+        drainOnce(false);
+        nanosleep(&interval, NULL);
+    }
+
+    return arg;
+}
+
+void logStart(LogMode mode, FILE *out)
+{
+    logMode = mode;
+    logOut = out;
+
+    if (mode == LOG_SILENT)
+        return;
+
+    sem_init(&buffersProtect, 0, 1);
+    generation++;
+    draining.store(true);
+
+    int errcode = pthread_create(&drainer, NULL, drainerThread, NULL);
+    if (errcode)
+    {
+        errexit(errcode, "pthread_create");
+    }
+}
+
+void logStop()
+{
+    if (logMode == LOG_SILENT)
+        return;
+
+    draining.store(false, std::memory_order_release);
+
+    int errcode = pthread_join(drainer, NULL);
+    if (errcode)
+    {
+        errexit(errcode, "pthread_join");
+    }
+
+    drainOnce(true);
+    fflush(logOut);
+
+    for (LogBuffer *buffer : buffers)
+        delete buffer;
+    buffers.clear();
+
+    sem_destroy(&buffersProtect);
+    logMode = LOG_SILENT;
+}
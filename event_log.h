@@ -0,0 +1,61 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Asynchronous event log. Threads append fixed-size binary records to their own ring and
+// never touch stdio. A drainer thread merges the rings by timestamp and either formats the
+// records as text or writes them raw, so the output follows real event order.
+
+// Every state transition the clinic reports. The actor is the first id in the message
+enum ClinicEvent
+{
+    EV_PATIENT_ENTERS,        // Patient <actor> enters waiting room, waits for receptionist
+    EV_RECEPTIONIST_RECEIVES, // Receptionist <actor> receives patient <arg0>
+    EV_PATIENT_SITS,          // Patient <actor> leaves receptionist and sits in waiting room
+    EV_PATIENT_TURNED_AWAY,   // Patient <actor> is turned away, nurse <arg0>'s waiting room is full
+    EV_NURSE_STEALS,          // Nurse <actor> takes patient <arg0> over from nurse <arg1>
+    EV_NURSE_TAKES,           // Nurse <actor> takes patient <arg0> to doctor's office
+    EV_PATIENT_IN_OFFICE,     // Patient <actor> enters doctor <arg0>'s office
+    EV_DOCTOR_LISTENS,        // Doctor <actor> listens to symptoms from patient <arg0>
+    EV_PATIENT_ADVISED,       // Patient <actor> receives advice from doctor <arg0>
+    EV_PATIENT_LEAVES,        // Patient <actor> leaves
+    EV_COUNT
+};
+
+// Layout of one record, also the on-disk format of binary mode (native endianness)
+struct EventRecord
+{
+    uint64_t timestamp; // CLOCK_MONOTONIC nanoseconds
+    uint16_t event;     // ClinicEvent
+    uint16_t reserved;
+    int32_t actor;
+    int32_t args[2];
+};
+
+enum LogMode
+{
+    LOG_TEXT,   // Formatted lines, same wording the clinic always printed
+    LOG_BINARY, // Raw EventRecords
+    LOG_SILENT  // Nothing recorded at all, for benchmarks
+};
+
+// Start the drainer. out must stay open until logStop
+void logStart(LogMode mode, FILE *out);
+
+extern LogMode logMode;
+
+void logAppend(ClinicEvent event, int actor, int arg0, int arg1);
+
+// Record one event from the calling thread. Never blocks on I/O
+inline void logEvent(ClinicEvent event, int actor, int arg0 = 0, int arg1 = 0)
+{
+    if (logMode != LOG_SILENT)
+        logAppend(event, actor, arg0, arg1);
+}
+
+// Write out every remaining record and stop the drainer. Call once all logging threads are done
+void logStop();
+
+#endif
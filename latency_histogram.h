@@ -0,0 +1,116 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+// Lock-free histogram of nanosecond latencies that any number of threads can record into.
+// Buckets are logarithmic: every power of two is split into SUB_BUCKETS equal steps, so a
+// reported percentile is at most 1 / SUB_BUCKETS above the true value, over the whole 64-bit range.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t value)
+    {
+        buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (value > seen && !largest.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+            ;
+    }
+
+    // record for a histogram only one thread ever touches: plain increments instead of atomic read-modify-writes
+    void recordUnshared(uint64_t value)
+    {
+        std::atomic<uint64_t> &bucket = buckets[bucketOf(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (value > largest.load(std::memory_order_relaxed))
+            largest.store(value, std::memory_order_relaxed);
+    }
+
+    // Add in every sample of other. Only exact once other has stopped recording
+    void merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            buckets[i].fetch_add(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        total.fetch_add(other.count(), std::memory_order_relaxed);
+
+        uint64_t seen = largest.load(std::memory_order_relaxed);
+        while (other.max() > seen && !largest.compare_exchange_weak(seen, other.max(), std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const
+    {
+        return largest.load(std::memory_order_relaxed);
+    }
+
+    // Smallest bucket bound at or above the given fraction of samples, never above max. 0 when empty.
+    // Only exact once recording has stopped
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t samples = count();
+        if (samples == 0)
+            return 0;
+
+        uint64_t rank = (uint64_t)(fraction * samples);
+        if (rank < 1)
+            rank = 1;
+        if (rank > samples)
+            rank = samples;
+
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                uint64_t bound = bucketHighest(i);
+                return bound < max() ? bound : max();
+            }
+        }
+
+        return max();
+    }
+
+private:
+    static int bucketOf(uint64_t value)
+    {
+        if (value < (uint64_t)SUB_BUCKETS)
+            return (int)value;
+
+        int exponent = 63 - __builtin_clzll(value);
+        int shift = exponent - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (int)((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // Largest value that lands in bucket
+    static uint64_t bucketHighest(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t lowest = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return lowest + ((uint64_t)1 << shift) - 1;
+    }
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> largest;
+};
+
+#endif
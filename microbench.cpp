@@ -0,0 +1,697 @@
+#include <cstring>
+#include <new>
+#include <errno.h>
+#include <string>
+#include <pthread.h>
+#include <semaphore.h>
+#include <queue>
+#include <cstdlib>
+#include <time.h>
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "spsc_ring.h"
+#include "random.h"
+#include "spin_semaphore.h"
+#include "topology.h"
+
+// Microbenchmarks for the building blocks of project2. Each mode prints one table
+
+#define errexit(code, str)                              \
+    fprintf(stderr, "%s: %s\n", (str), strerror(code)); \
+    exit(1);
+
+// ----- Utils
+
+double nowSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void startThread(pthread_t &thread, void *(*routine)(void *), void *arg)
+{
+    int errcode = pthread_create(&thread, NULL, routine, arg);
+    if (errcode)
+    {
+        errexit(errcode, "pthread_create");
+    }
+}
+
+void joinThread(pthread_t thread)
+{
+    int errcode = pthread_join(thread, NULL);
+    if (errcode)
+    {
+        errexit(errcode, "pthread_join");
+    }
+}
+
+void printRow(const char *name, int items, double seconds)
+{
+    printf("%-28s %12.1f %12.1f\n", name, items / seconds / 1e6, seconds * 1e9 / items);
+}
+
+// ----- Waiting room: std::queue + sem_t (what project2 used) against SpscRing
+
+#define RING_CAPACITY 4096
+
+// The previous waiting room: a queue guarded by a semaphore, plus a count semaphore to sleep on
+struct LockedRoom
+{
+    sem_t protect;
+    std::queue<int> queue;
+    sem_t items;
+
+    void init()
+    {
+        sem_init(&protect, 0, 1);
+        sem_init(&items, 0, 0);
+    }
+
+    void push(int item)
+    {
+        sem_wait(&protect);
+        queue.push(item);
+        sem_post(&protect);
+        sem_post(&items);
+    }
+
+    int pop()
+    {
+        sem_wait(&items);
+        sem_wait(&protect);
+        int item = queue.front();
+        queue.pop();
+        sem_post(&protect);
+        return item;
+    }
+};
+
+// SpscRing with the count semaphore project2 keeps for sleeping nurses
+struct RingRoom
+{
+    SpscRing<int> ring;
+    int storage[RING_CAPACITY];
+    sem_t items;
+
+    void init()
+    {
+        ring.init(storage, RING_CAPACITY);
+        sem_init(&items, 0, 0);
+    }
+
+    void push(int item)
+    {
+        while (!ring.push(item))
+            sched_yield();
+        sem_post(&items);
+    }
+
+    int pop()
+    {
+        sem_wait(&items);
+
+        // The post comes after the push, so the item is there
+        int item;
+        while (!ring.pop(item))
+            sched_yield();
+        return item;
+    }
+};
+
+// SpscRing alone, yielding when empty or full
+struct SpinRoom
+{
+    SpscRing<int> ring;
+    int storage[RING_CAPACITY];
+
+    void init()
+    {
+        ring.init(storage, RING_CAPACITY);
+    }
+
+    void push(int item)
+    {
+        while (!ring.push(item))
+            sched_yield();
+    }
+
+    int pop()
+    {
+        int item;
+        while (!ring.pop(item))
+            sched_yield();
+        return item;
+    }
+};
+
+int ringItems;
+
+template <typename Room>
+void *roomProducer(void *arg)
+{
+    Room &room = *(Room *)arg;
+    for (int i = 0; i < ringItems; i++)
+        room.push(i);
+    return arg;
+}
+
+template <typename Room>
+void *roomConsumer(void *arg)
+{
+    Room &room = *(Room *)arg;
+    for (int i = 0; i < ringItems; i++)
+    {
+        if (room.pop() != i)
+        {
+            fprintf(stderr, "Waiting room lost FIFO order\n");
+            exit(1);
+        }
+    }
+    return arg;
+}
+
+// One producer and one consumer thread moving ringItems through the room
+template <typename Room>
+double roomThroughput()
+{
+    Room *room = new Room();
+    room->init();
+
+    pthread_t producer, consumer;
+    double start = nowSeconds();
+    startThread(consumer, roomConsumer<Room>, room);
+    startThread(producer, roomProducer<Room>, room);
+    joinThread(producer);
+    joinThread(consumer);
+    double seconds = nowSeconds() - start;
+
+    delete room;
+    return seconds;
+}
+
+// Enqueue then dequeue on one thread: the uncontended cost of a handoff
+template <typename Room>
+double roomLatency()
+{
+    Room *room = new Room();
+    room->init();
+
+    double start = nowSeconds();
+    for (int i = 0; i < ringItems; i++)
+    {
+        room->push(i);
+        room->pop();
+    }
+    double seconds = nowSeconds() - start;
+
+    delete room;
+    return seconds;
+}
+
+void benchRing(int items)
+{
+    ringItems = items;
+
+    printf("%d items, capacity %d\n", items, RING_CAPACITY);
+    printf("%-28s %12s %12s\n", "waiting room", "Mops/s", "ns/op");
+
+    printRow("queue+sem_t push/pop", items, roomLatency<LockedRoom>());
+    printRow("spsc+sem_t push/pop", items, roomLatency<RingRoom>());
+    printRow("spsc push/pop", items, roomLatency<SpinRoom>());
+
+    printRow("queue+sem_t 2 threads", items, roomThroughput<LockedRoom>());
+    printRow("spsc+sem_t 2 threads", items, roomThroughput<RingRoom>());
+    printRow("spsc 2 threads", items, roomThroughput<SpinRoom>());
+}
+
+// ----- Random draws: glibc rand() against a thread-local xoshiro256**
+
+int drawsPerThread;
+
+// Each thread's generator, seeded from its own stream on first use in that thread
+thread_local Xoshiro256 threadRandom;
+
+struct DrawThread
+{
+    pthread_t thread;
+    int id;
+    unsigned sum; // Keeps the draws from being optimized away
+};
+
+void *drawRand(void *arg)
+{
+    DrawThread &drawer = *(DrawThread *)arg;
+    unsigned sum = 0;
+    for (int i = 0; i < drawsPerThread; i++)
+        sum += rand() % 8;
+    drawer.sum = sum;
+    return arg;
+}
+
+void *drawXoshiro(void *arg)
+{
+    DrawThread &drawer = *(DrawThread *)arg;
+    threadRandom.seed(1, drawer.id);
+
+    unsigned sum = 0;
+    for (int i = 0; i < drawsPerThread; i++)
+        sum += threadRandom.inRange(0, 7);
+    drawer.sum = sum;
+    return arg;
+}
+
+// numThreads threads each making drawsPerThread draws at once
+double drawThroughput(void *(*routine)(void *), int numThreads)
+{
+    DrawThread *drawers = new DrawThread[numThreads];
+
+    double start = nowSeconds();
+    for (int id = 0; id < numThreads; id++)
+    {
+        drawers[id].id = id;
+        startThread(drawers[id].thread, routine, &drawers[id]);
+    }
+    for (int id = 0; id < numThreads; id++)
+        joinThread(drawers[id].thread);
+    double seconds = nowSeconds() - start;
+
+    delete[] drawers;
+    return seconds;
+}
+
+void benchRandom(int draws)
+{
+    drawsPerThread = draws;
+
+    printf("%d draws per thread\n", draws);
+    printf("%-28s %12s %12s\n", "random draws", "Mops/s", "ns/op");
+
+    char name[64];
+    for (int numThreads = 1; numThreads <= 8; numThreads *= 2)
+    {
+        snprintf(name, sizeof(name), "rand() %d threads", numThreads);
+        printRow(name, draws * numThreads, drawThroughput(drawRand, numThreads));
+
+        snprintf(name, sizeof(name), "xoshiro256** %d threads", numThreads);
+        printRow(name, draws * numThreads, drawThroughput(drawXoshiro, numThreads));
+    }
+}
+
+// ----- Handoff: two threads passing a turn back and forth, raw sem_t against SpinSemaphore
+
+int handoffRounds;
+
+struct RawSemaphore
+{
+    sem_t sem;
+
+    void init()
+    {
+        sem_init(&sem, 0, 0);
+    }
+
+    void wait()
+    {
+        while (sem_wait(&sem) == -1)
+            ;
+    }
+
+    void post()
+    {
+        sem_post(&sem);
+    }
+};
+
+// For a handoff between processes, in memory both have mapped
+struct SharedSemaphore : RawSemaphore
+{
+    void init()
+    {
+        sem_init(&sem, 1, 0);
+    }
+};
+
+template <bool spinning>
+struct AdaptiveSemaphore
+{
+    SpinSemaphore sem;
+
+    void init()
+    {
+        sem.init(0, spinning, false);
+    }
+
+    void wait()
+    {
+        sem.wait();
+    }
+
+    void post()
+    {
+        sem.post();
+    }
+};
+
+// Each side waits on its own semaphore and posts the other's, like a nurse and a doctor handing off a patient
+template <typename Semaphore>
+struct PingPong
+{
+    Semaphore ping;
+    Semaphore pong;
+};
+
+// CPUs for the two sides of a handoff. -1 leaves that side to the kernel
+int pingCpu = -1;
+int pongCpu = -1;
+
+void pinSelf(int cpu)
+{
+    if (cpu == -1)
+        return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int errcode = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (errcode)
+    {
+        errexit(errcode, "pthread_setaffinity_np");
+    }
+}
+
+template <typename Semaphore>
+void *handoffPonger(void *arg)
+{
+    PingPong<Semaphore> &pair = *(PingPong<Semaphore> *)arg;
+    pinSelf(pongCpu);
+    for (int i = 0; i < handoffRounds; i++)
+    {
+        pair.ping.wait();
+        pair.pong.post();
+    }
+    return arg;
+}
+
+// Seconds for handoffRounds round trips, each two handoffs
+template <typename Semaphore>
+double handoffRoundTrips()
+{
+    PingPong<Semaphore> *pair = new PingPong<Semaphore>();
+    pair->ping.init();
+    pair->pong.init();
+
+    // The pinger is this thread, so put its CPUs back afterwards
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    pinSelf(pingCpu);
+
+    pthread_t ponger;
+    startThread(ponger, handoffPonger<Semaphore>, pair);
+
+    double start = nowSeconds();
+    for (int i = 0; i < handoffRounds; i++)
+    {
+        pair->ping.post();
+        pair->pong.wait();
+    }
+    double seconds = nowSeconds() - start;
+
+    joinThread(ponger);
+    sched_setaffinity(0, sizeof(allowed), &allowed);
+    delete pair;
+    return seconds;
+}
+
+// The same round trips with the ponger in a forked process, as between project2 --processes staff
+double handoffAcrossProcesses()
+{
+    void *shared = mmap(NULL, sizeof(PingPong<SharedSemaphore>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        errexit(errno, "mmap");
+    }
+
+    PingPong<SharedSemaphore> *pair = new (shared) PingPong<SharedSemaphore>();
+    pair->ping.init();
+    pair->pong.init();
+
+    fflush(stdout);
+    pid_t ponger = fork();
+    if (ponger == -1)
+    {
+        errexit(errno, "fork");
+    }
+    if (ponger == 0)
+    {
+        handoffPonger<SharedSemaphore>(pair);
+        _exit(0);
+    }
+
+    double start = nowSeconds();
+    for (int i = 0; i < handoffRounds; i++)
+    {
+        pair->ping.post();
+        pair->pong.wait();
+    }
+    double seconds = nowSeconds() - start;
+
+    waitpid(ponger, NULL, 0);
+    munmap(shared, sizeof(PingPong<SharedSemaphore>));
+    return seconds;
+}
+
+void benchHandoff(int rounds)
+{
+    handoffRounds = rounds;
+
+    printf("%d round trips, %ld CPUs\n", rounds, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-28s %12s %12s\n", "handoff", "Mtrips/s", "ns/trip");
+
+    printRow("sem_t", rounds, handoffRoundTrips<RawSemaphore>());
+    printRow("SpinSemaphore, no spin", rounds, handoffRoundTrips<AdaptiveSemaphore<false> >());
+    printRow("SpinSemaphore, spin", rounds, handoffRoundTrips<AdaptiveSemaphore<true> >());
+    printRow("sem_t, two processes", rounds, handoffAcrossProcesses());
+
+    // The same sem_t handoff with both sides pinned, for the placements project2 can ask for
+    Topology topology;
+    readTopology(topology);
+    const std::vector<int> &first = topology.cores[0];
+
+    int sameNodeCore = -1, otherNodeCore = -1;
+    for (size_t core = 1; core < topology.cores.size(); core++)
+    {
+        if (topology.nodeOfCore[core] == topology.nodeOfCore[0] && sameNodeCore == -1)
+            sameNodeCore = core;
+        if (topology.nodeOfCore[core] != topology.nodeOfCore[0] && otherNodeCore == -1)
+            otherNodeCore = core;
+    }
+
+    struct
+    {
+        const char *name;
+        int ping, pong;
+    } placements[] = {{"sem_t, same CPU", first[0], first[0]},
+                      {"sem_t, sibling hyperthread", first[0], first.size() > 1 ? first[1] : -1},
+                      {"sem_t, other core", first[0], sameNodeCore == -1 ? -1 : topology.cores[sameNodeCore][0]},
+                      {"sem_t, other node", first[0], otherNodeCore == -1 ? -1 : topology.cores[otherNodeCore][0]}};
+
+    printf("Topology: ");
+    printTopology(topology);
+
+    for (auto &placement : placements)
+    {
+        if (placement.pong == -1)
+        {
+            printf("%-28s %12s %12s\n", placement.name, "-", "-");
+            continue;
+        }
+
+        pingCpu = placement.ping;
+        pongCpu = placement.pong;
+        printRow(placement.name, rounds, handoffRoundTrips<RawSemaphore>());
+    }
+
+    pingCpu = -1;
+    pongCpu = -1;
+}
+
+// ----- Shared counters: one semaphore-guarded count, one atomic, and per-thread slots packed or padded
+
+int countsPerThread;
+
+// Hardware cache misses of this process and the threads it starts from now on. -1 when the kernel or the
+// machine has no such counter, as in most containers and VMs
+int openCacheMisses()
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+struct CountThread
+{
+    pthread_t thread;
+    int id;
+};
+
+sem_t guardedProtect;
+int guardedCount;
+std::atomic<int> atomicCount;
+
+// One slot per thread, next to each other: every increment steals the line from the other threads
+std::atomic<int> packedSlots[64];
+
+struct alignas(64) PaddedSlot
+{
+    std::atomic<int> count;
+};
+PaddedSlot paddedSlots[64];
+
+void *countGuarded(void *arg)
+{
+    for (int i = 0; i < countsPerThread; i++)
+    {
+        sem_wait(&guardedProtect);
+        guardedCount++;
+        sem_post(&guardedProtect);
+    }
+    return arg;
+}
+
+void *countAtomic(void *arg)
+{
+    for (int i = 0; i < countsPerThread; i++)
+        atomicCount.fetch_add(1, std::memory_order_relaxed);
+    return arg;
+}
+
+// Only the owner writes a slot, so a load and a store will do, as for a plain int
+void *countPacked(void *arg)
+{
+    std::atomic<int> &slot = packedSlots[((CountThread *)arg)->id];
+    for (int i = 0; i < countsPerThread; i++)
+        slot.store(slot.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return arg;
+}
+
+void *countPadded(void *arg)
+{
+    std::atomic<int> &slot = paddedSlots[((CountThread *)arg)->id].count;
+    for (int i = 0; i < countsPerThread; i++)
+        slot.store(slot.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return arg;
+}
+
+// numThreads threads each counting countsPerThread times. misses is -1 without a hardware counter
+double countThroughput(void *(*routine)(void *), int numThreads, long long &misses)
+{
+    CountThread *counters = new CountThread[numThreads];
+    int counter = openCacheMisses();
+
+    double start = nowSeconds();
+    for (int id = 0; id < numThreads; id++)
+    {
+        counters[id].id = id;
+        startThread(counters[id].thread, routine, &counters[id]);
+    }
+    for (int id = 0; id < numThreads; id++)
+        joinThread(counters[id].thread);
+    double seconds = nowSeconds() - start;
+
+    misses = -1;
+    if (counter != -1)
+    {
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+            misses = -1;
+        close(counter);
+    }
+
+    delete[] counters;
+    return seconds;
+}
+
+void benchCounters(int counts)
+{
+    countsPerThread = counts;
+    sem_init(&guardedProtect, 0, 1);
+
+    printf("%d increments per thread, %ld CPUs, cache misses %s\n", counts, sysconf(_SC_NPROCESSORS_ONLN),
+           openCacheMisses() == -1 ? "not available here" : "per increment");
+    printf("%-28s %12s %12s %12s\n", "shared counters", "Mops/s", "ns/op", "misses/op");
+
+    struct
+    {
+        const char *name;
+        void *(*routine)(void *);
+    } variants[] = {{"sem_t guarded", countGuarded}, {"atomic", countAtomic}, {"packed slots", countPacked}, {"padded slots", countPadded}};
+
+    char name[64];
+    for (int numThreads = 1; numThreads <= 16; numThreads *= 2)
+    {
+        for (auto &variant : variants)
+        {
+            long long misses;
+            double seconds = countThroughput(variant.routine, numThreads, misses);
+            long long items = (long long)counts * numThreads;
+
+            snprintf(name, sizeof(name), "%s %d threads", variant.name, numThreads);
+            printf("%-28s %12.1f %12.1f ", name, items / seconds / 1e6, seconds * 1e9 / items);
+            if (misses == -1)
+                printf("%12s\n", "-");
+            else
+                printf("%12.3f\n", (double)misses / items);
+        }
+    }
+
+    sem_destroy(&guardedProtect);
+}
+
+// ----- Main
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s ring [items]\n"
+                    "       %s random [draws per thread]\n"
+                    "       %s handoff [round trips]\n"
+                    "       %s counters [increments per thread]\n",
+            program, program, program, program);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+    }
+
+    std::string mode = argv[1];
+
+    if (mode == "ring")
+        benchRing(argc > 2 ? atoi(argv[2]) : 10000000);
+    else if (mode == "random")
+        benchRandom(argc > 2 ? atoi(argv[2]) : 10000000);
+    else if (mode == "handoff")
+        benchHandoff(argc > 2 ? atoi(argv[2]) : 200000);
+    else if (mode == "counters")
+        benchCounters(argc > 2 ? atoi(argv[2]) : 2000000);
+    else
+        usage(argv[0]);
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free ring for any number of producer and consumer threads (Vyukov's design).
+// Every cell carries a sequence number that tells whether it is free for the producer
+// at position pos (sequence == pos) or holds an item for the consumer at pos (sequence == pos + 1),
+// so producers and consumers only contend on their own position counter.
+// Storage is handed in by the owner (the clinic arena), capacity must be a power of two and at least 2.
+template <typename T>
+class MpmcRing
+{
+public:
+    struct Cell
+    {
+        std::atomic<unsigned> sequence;
+        T data;
+    };
+
+    static size_t storageBytes(unsigned capacity)
+    {
+        return sizeof(Cell) * capacity;
+    }
+
+    void init(Cell *storage, unsigned capacity)
+    {
+        cells = storage;
+        mask = capacity - 1;
+
+        for (unsigned i = 0; i < capacity; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    unsigned capacity() const
+    {
+        return mask + 1;
+    }
+
+    // False when the ring is full
+    bool push(const T &item)
+    {
+        unsigned pos = enqueuePos.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            int diff = (int)(cell.sequence.load(std::memory_order_acquire) - pos);
+
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.data = item;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // False when the ring is empty
+    bool pop(T &item)
+    {
+        unsigned pos = dequeuePos.load(std::memory_order_relaxed);
+
+        while (true)
+        {
+            Cell &cell = cells[pos & mask];
+            int diff = (int)(cell.sequence.load(std::memory_order_acquire) - (pos + 1));
+
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    item = cell.data;
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Snapshot of the number of queued items, safe from any thread
+    unsigned size() const
+    {
+        // Consumer position first: it never passes the producer position read after it
+        unsigned dequeued = dequeuePos.load(std::memory_order_acquire);
+        return enqueuePos.load(std::memory_order_acquire) - dequeued;
+    }
+
+private:
+    // Read-only after init
+    Cell *cells;
+    unsigned mask;
+
+    alignas(64) std::atomic<unsigned> enqueuePos;
+    alignas(64) std::atomic<unsigned> dequeuePos;
+};
+
+#endif
@@ -1,16 +1,16 @@
-#include <cstring>
 #include <string>
+#include <vector>
 #include <iostream>
-#include <pthread.h>
-#include <semaphore.h>
-#include <queue>
 #include <cstdlib>
 #include <time.h>
 #include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
-#define errexit(code, str)                              \
-    fprintf(stderr, "%s: %s\n", (str), strerror(code)); \
-    exit(1);
+#include "clinic.h"
+#include "event_log.h"
+#include "sem_stats.h"
+#include "shards.h"
 
 // ----- Utils
 
@@ -29,558 +29,503 @@ int stoiHandler(std::string s)
     return num;
 }
 
-// Both bounds are inclusive
-int randomInRange(int lb, int ub)
+// "0.002" or "fixed:0.002", "exp:0.002", "lognormal:0.002:0.5". False on anything else
+bool parseService(const char *text, ServiceTime &service)
 {
-    return (rand() % (ub - lb + 1)) + lb;
-}
+    double mean, sigma;
+    char tail;
 
-void semWait(sem_t &sem, const char *name)
-{
-    if (sem_wait(&sem) == -1)
+    service.sigma = 0;
+
+    if (sscanf(text, "lognormal:%lf:%lf%c", &mean, &sigma, &tail) == 2 && sigma >= 0)
     {
-        printf("Wait on semaphore %s\n", name);
-        exit(1);
+        service.distribution = SERVICE_LOGNORMAL;
+        service.sigma = sigma;
     }
+    else if (sscanf(text, "exp:%lf%c", &mean, &tail) == 1)
+        service.distribution = SERVICE_EXPONENTIAL;
+    else if (sscanf(text, "fixed:%lf%c", &mean, &tail) == 1 || sscanf(text, "%lf%c", &mean, &tail) == 1)
+        service.distribution = SERVICE_FIXED;
+    else
+        return false;
+
+    service.mean = mean;
+    return mean >= 0;
 }
 
-void semPost(sem_t &sem, const char *name)
+// One arrival per line, in seconds after opening, nondecreasing. Empty on a malformed file
+std::vector<double> loadTrace(const char *path)
 {
-    if (sem_post(&sem) == -1)
+    std::vector<double> arrivals;
+
+    FILE *trace = fopen(path, "r");
+    if (trace == NULL)
     {
-        printf("Post semaphore %s\n", name);
+        perror(path);
         exit(1);
     }
-}
 
-void semInit(sem_t &sem, const char *name, int value)
-{
-    /* Initialize semaphore to 0 (3rd parameter) */
-    if (sem_init(&sem, 0, value) == -1)
+    double arrival;
+    while (fscanf(trace, "%lf", &arrival) == 1)
     {
-        printf("Init semaphore %s\n", name);
-        exit(1);
+        if (arrival < 0 || (!arrivals.empty() && arrival < arrivals.back()))
+        {
+            arrivals.clear();
+            break;
+        }
+        arrivals.push_back(arrival);
     }
-}
 
-// ----- Thread procedures
+    if (!feof(trace))
+        arrivals.clear();
 
-int numDoctors;
-int numNurses;
-int numPatients;
-
-sem_t waitEachPatientRegister; // Each patient register in turn
-
-int receptionistPatients = 0; // Count of patients the receptionist has received
-
-int registerPatientId = -1;     // Current patient id that receptionist is processing
-sem_t patientCheckIn;           // Patient just registered. Receptionist waits for a patient to checking in before register that patient with the nurse
-sem_t receptionistRegisterDone; // Receptionist finishes registering for current patient
-sem_t patientLeaveReceptionist; // Patient signals to receptionist that he/she leaves the receptionist. Receptionist then notices to nurse
-
-sem_t nursePatientsProtect; // Protection for count since all nurses have access to
-int nursePatients = 0;      // Count of patients all nurses have processed
-
-int *nurseOfPatient;     // Array (Size = Patients) - Assigned nurse of a patient
-sem_t *patientWaitNurse; // Array (Size = Patients) - Nurses can use this to signal each patient that it's their turn
-
-sem_t *nurseQueueProtect;    // Array (Size = Nurses) - Protection for queue since the receptionist and nurses can work concurrently on these queues
-std::queue<int> *nurseQueue; // Array (Size = Nurses) - Waiting room of patients for each nurse
-sem_t *patientJoinWaitRoom;  // Array (Size = Nurses) - Each nurse takes a patient from waiting room. Patient posts when they join wait room
-
-sem_t doctorPatientsProtect; // Protection of count since all doctors have access to
-int doctorPatients = 0;      // Count of patients all doctors have processed
-
-sem_t *doctorReady;   // Array (Size = Doctors) - Whether each doctor is ready or not. For nurse to send in new patient
-int *patientOfDoctor; // Array (Size = Doctors) - Current patient of a doctor. Default to -1 meaning no patient
-
-sem_t *patientSymptom; // Array (Size = Doctors) - Each doctor listens to patient symptom
-sem_t *doctorAdvice;   // Array (Size = Doctors) - Each doctor gives out advice
-sem_t *patientLeave;   // Array (Size = Doctors) - Each doctor waits for patient to leave
+    fclose(trace);
+    return arrivals;
+}
 
-void *patientThread(void *arg)
+// "a,b,c" of non-negative numbers, one per triage class. False on anything else
+bool parseTriple(const char *text, int values[PRIORITY_COUNT])
 {
-    int patientId = *(int *)arg;
-
-    // Randomly assign a nurse to patient
-    int randomNurseId = randomInRange(0, numNurses - 1);
-    nurseOfPatient[patientId] = randomNurseId;
-
-    int assignedNurseId = randomNurseId;
-    int assignedDoctorId = assignedNurseId;
-
-    // --- Register phase
-
-    printf("Patient %d enters waiting room, waits for receptionist\n", patientId);
-
-    // Wait for the patient's turn to check in and register
-    semWait(waitEachPatientRegister, "waitEachPatientRegister");
-
-    registerPatientId = patientId;
-
-    semPost(patientCheckIn, "patientCheckIn");
-
-    semWait(receptionistRegisterDone, "receptionistRegisterDone");
-
-    printf("Patient %d leaves receptionist and sits in waiting room\n", patientId);
-
-    semPost(patientLeaveReceptionist, "patientLeaveReceptionist");
-
-    semPost(waitEachPatientRegister, "waitEachPatientRegister");
-
-    // --- Nurse phase
-
-    semWait(patientWaitNurse[patientId], "patientWaitNurse - patientId");
-
-    // --- Doctor phase
-
-    printf("Patient %d enters doctor %d's office\n", patientId, assignedDoctorId);
-
-    semPost(patientSymptom[assignedDoctorId], "patientSymptom - assignedDoctorId");
-
-    semWait(doctorAdvice[assignedDoctorId], "doctorAdvice - assignedDoctorId");
-
-    printf("Patient %d receives advice from doctor %d\n", patientId, assignedDoctorId);
-
-    semPost(patientLeave[assignedDoctorId], "patientLeave - assignedDoctorId");
-
-    // --- Leave phase
-
-    printf("Patient %d leaves\n", patientId);
-
-    return arg;
+    char tail;
+    return sscanf(text, "%d,%d,%d%c", &values[0], &values[1], &values[2], &tail) == 3 &&
+           values[0] >= 0 && values[1] >= 0 && values[2] >= 0;
 }
 
-void *receptionistThread(void *arg)
+void usage(const char *program)
 {
-    while (receptionistPatients < numPatients)
-    {
-        // Wait for a patient to check in
-        semWait(patientCheckIn, "patientCheckIn");
-
-        printf("Receptionist receives patient %d\n", registerPatientId);
-
-        int nurseId = nurseOfPatient[registerPatientId];
-
-        // Add that patient to that nurse's wait room
-        semWait(nurseQueueProtect[nurseId], "nurseQueueProtect - nurseId");
-        nurseQueue[nurseId].push(registerPatientId);
-        semPost(nurseQueueProtect[nurseId], "nurseQueueProtect - nurseId");
-
-        // Increase processed patients for the only receptionist
-        receptionistPatients++;
-
-        // Tell patient that registration is done
-        semPost(receptionistRegisterDone, "receptionistRegisterDone");
-
-        // Wait for the patient to leave and sit in the waiting to tell the nurse
-        semWait(patientLeaveReceptionist, "patientLeaveReceptionist");
-
-        // Tell nurse that a new patient joins waiting room
-        semPost(patientJoinWaitRoom[nurseId], "patientJoinWaitRoom - nurseId");
-    }
-
-    return arg;
+    fprintf(stderr, "Usage: %s <doctors> <patients> [--nurses N] [--workers N] [--receptionists N] [--assign random|shortest] [--steal] [--dispatch shared|pinned]\n"
+                    "       [--room-capacity N] [--overflow block|divert|reject]\n"
+                    "       [--admission-batch N] [--admission-timeout SECONDS] [--placement none|paired|isolated|spread] [--processes]\n"
+                    "       [--shards N] [--route round-robin|least-loaded|two-choices] [--stats PATH] [--trace PATH]\n"
+                    "       [--log text|binary|silent] [--log-file PATH] [--engine threads|coroutines|simulation]\n"
+                    "       [--arrivals batch|poisson:RATE|trace:FILE] [--timing sleep|spin|hybrid] [--sync semaphore|spin] [--seed N]\n"
+                    "       [--triage URGENT%%,STANDARD%%,LOW%%] [--triage-weights URGENT,STANDARD,LOW]\n"
+                    "       [--reception-service DIST] [--nurse-service DIST] [--doctor-service DIST]\n"
+                    "       DIST is seconds: S, fixed:S, exp:MEAN or lognormal:MEAN:SIGMA\n",
+            program);
+    exit(1);
 }
 
-void *nurseThread(void *arg)
+// ----- Main
+
+int main(int argc, char **argv)
 {
-    int nurseId = *(int *)arg;
-    int doctorId = nurseId;
+    timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
 
-    while (true)
+    if (argc < 3)
     {
-        // Check break condition for nurse
-        if (nursePatients >= numPatients)
-            break;
-
-        // Check nurse queue and get patient id
-        if (nurseQueue[nurseId].empty())
-            continue;
-
-        int patientId = nurseQueue[nurseId].front();
-
-        // Wait for front patient to join wait room
-        semWait(patientJoinWaitRoom[nurseId], "patientJoinWaitRoom - nurseId");
-
-        // Wait for doctor to ready
-        semWait(doctorReady[doctorId], "doctorReady - doctorId");
-
-        // Take patient out of wait room and to doctor's office
-        semWait(nurseQueueProtect[nurseId], "nurseQueueProtect - randomNurseId");
-        nurseQueue[nurseId].pop();
-        semPost(nurseQueueProtect[nurseId], "nurseQueueProtect - randomNurseId");
-
-        printf("Nurse %d takes patient %d to doctor's office\n", nurseId, patientId);
-
-        patientOfDoctor[doctorId] = patientId;
-
-        // Increase processed patients of all nurses
-        semWait(nursePatientsProtect, "nursePatientsProtect");
-        nursePatients++;
-        semPost(nursePatientsProtect, "nursePatientsProtect");
-
-        // Signal front patient that it's their turn
-        semPost(patientWaitNurse[patientId], "patientWaitNurse - patientId");
+        usage(argv[0]);
     }
 
-    return arg;
-}
+    ClinicConfig config;
 
-void *doctorThread(void *arg)
-{
-    int doctorId = *(int *)arg;
-
-    while (true)
+    // Get command line inputs
+    config.numDoctors = stoiHandler(argv[1]);
+    config.numNurses = 0;
+    config.numPatients = stoiHandler(argv[2]);
+    config.numWorkers = 0; // One per CPU, split between shards, unless told otherwise
+    config.numReceptionists = 1;
+    config.assignPolicy = ASSIGN_RANDOM;
+    config.steal = false;
+    config.roomCapacity = 0;
+    config.overflow = OVERFLOW_BLOCK;
+    config.admissionBatch = 1;
+    config.admissionTimeout = 1e-3;
+    config.dispatchPolicy = DISPATCH_SHARED;
+    config.placement = PLACE_NONE;
+    config.processes = false;
+    config.engine = ENGINE_THREADS;
+    config.arrivals = ARRIVAL_BATCH;
+    config.arrivalRate = 0;
+    config.arrivalTrace = NULL;
+    config.receptionService = {SERVICE_FIXED, 0, 0};
+    config.nurseService = {SERVICE_FIXED, 0, 0};
+    config.doctorService = {SERVICE_FIXED, 0, 0};
+    config.timing = TIMING_HYBRID;
+    config.sync = SYNC_SEMAPHORE;
+    config.seed = time(NULL); // Printed below, so any run can be repeated with --seed
+
+    // Everyone standard until told otherwise, which is one FIFO per room as before triage
+    config.triageShare[PRIORITY_URGENT] = 0;
+    config.triageShare[PRIORITY_STANDARD] = 100;
+    config.triageShare[PRIORITY_LOW] = 0;
+    config.triageWeights[PRIORITY_URGENT] = 8;
+    config.triageWeights[PRIORITY_STANDARD] = 3;
+    config.triageWeights[PRIORITY_LOW] = 1;
+
+    int numShards = 1;
+    RoutePolicy route = ROUTE_ROUND_ROBIN;
+
+    LogMode logMode = LOG_TEXT;
+    const char *logPath = NULL;
+    const char *statsPath = NULL;
+    const char *tracePath = NULL;
+    std::vector<double> trace;
+
+    for (int i = 3; i < argc; i++)
     {
-        // Check break condition for doctor
-        if (doctorPatients >= numPatients)
-            break;
-
-        // Check if doctor has patient
-        int patientId = patientOfDoctor[doctorId];
-        if (patientId == -1)
-            continue;
-
-        // Wait for current patient to tell symptoms
-        semWait(patientSymptom[doctorId], "patientSymptom");
-
-        printf("Doctor %d listens to symptoms from patient %d\n", doctorId, patientId);
-
-        // Give advice to patient
-        semPost(doctorAdvice[doctorId], "doctorAdvice - doctorId");
-
-        // Wait for patient to leave
-        semWait(patientLeave[doctorId], "patientLeave - doctorId");
-
-        // Reset current patient of doctor to no one
-        patientOfDoctor[doctorId] = -1;
-
-        // Increase processed patients of all doctors
-        semWait(doctorPatientsProtect, "doctorPatientsProtect");
-        doctorPatients++;
-        semPost(doctorPatientsProtect, "doctorPatientsProtect");
-
-        // Tell nurse that doctor is ready for next patient
-        semPost(doctorReady[doctorId], "doctorReady - doctorId");
+        std::string option = argv[i];
+
+        if (option == "--nurses" && i + 1 < argc)
+            config.numNurses = stoiHandler(argv[++i]);
+        else if (option == "--workers" && i + 1 < argc)
+            config.numWorkers = stoiHandler(argv[++i]);
+        else if (option == "--receptionists" && i + 1 < argc)
+            config.numReceptionists = stoiHandler(argv[++i]);
+        else if (option == "--assign" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+
+            if (policy == "random")
+                config.assignPolicy = ASSIGN_RANDOM;
+            else if (policy == "shortest")
+                config.assignPolicy = ASSIGN_SHORTEST;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--steal")
+            config.steal = true;
+        else if (option == "--room-capacity" && i + 1 < argc)
+            config.roomCapacity = stoiHandler(argv[++i]);
+        else if (option == "--overflow" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+
+            if (policy == "block")
+                config.overflow = OVERFLOW_BLOCK;
+            else if (policy == "divert")
+                config.overflow = OVERFLOW_DIVERT;
+            else if (policy == "reject")
+                config.overflow = OVERFLOW_REJECT;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--processes")
+            config.processes = true;
+        else if (option == "--stats" && i + 1 < argc)
+            statsPath = argv[++i];
+        else if (option == "--trace" && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (option == "--shards" && i + 1 < argc)
+            numShards = stoiHandler(argv[++i]);
+        else if (option == "--route" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+
+            if (policy == "round-robin")
+                route = ROUTE_ROUND_ROBIN;
+            else if (policy == "least-loaded")
+                route = ROUTE_LEAST_LOADED;
+            else if (policy == "two-choices")
+                route = ROUTE_TWO_CHOICES;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--placement" && i + 1 < argc)
+        {
+            std::string placement = argv[++i];
+
+            if (placement == "none")
+                config.placement = PLACE_NONE;
+            else if (placement == "paired")
+                config.placement = PLACE_PAIRED;
+            else if (placement == "isolated")
+                config.placement = PLACE_ISOLATED;
+            else if (placement == "spread")
+                config.placement = PLACE_SPREAD;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--admission-batch" && i + 1 < argc)
+            config.admissionBatch = stoiHandler(argv[++i]);
+        else if (option == "--admission-timeout" && i + 1 < argc)
+            config.admissionTimeout = atof(argv[++i]);
+        else if (option == "--dispatch" && i + 1 < argc)
+        {
+            std::string policy = argv[++i];
+
+            if (policy == "shared")
+                config.dispatchPolicy = DISPATCH_SHARED;
+            else if (policy == "pinned")
+                config.dispatchPolicy = DISPATCH_PINNED;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--log" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+
+            if (mode == "text")
+                logMode = LOG_TEXT;
+            else if (mode == "binary")
+                logMode = LOG_BINARY;
+            else if (mode == "silent")
+                logMode = LOG_SILENT;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--log-file" && i + 1 < argc)
+            logPath = argv[++i];
+        else if (option == "--engine" && i + 1 < argc)
+        {
+            std::string engine = argv[++i];
+
+            if (engine == "threads")
+                config.engine = ENGINE_THREADS;
+            else if (engine == "coroutines")
+                config.engine = ENGINE_COROUTINES;
+            else if (engine == "simulation")
+                config.engine = ENGINE_SIMULATION;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--reception-service" && i + 1 < argc)
+        {
+            if (!parseService(argv[++i], config.receptionService))
+                usage(argv[0]);
+        }
+        else if (option == "--nurse-service" && i + 1 < argc)
+        {
+            if (!parseService(argv[++i], config.nurseService))
+                usage(argv[0]);
+        }
+        else if (option == "--doctor-service" && i + 1 < argc)
+        {
+            if (!parseService(argv[++i], config.doctorService))
+                usage(argv[0]);
+        }
+        else if (option == "--arrivals" && i + 1 < argc)
+        {
+            std::string arrivals = argv[++i];
+
+            if (arrivals == "batch")
+                config.arrivals = ARRIVAL_BATCH;
+            else if (arrivals.compare(0, 8, "poisson:") == 0)
+            {
+                config.arrivals = ARRIVAL_POISSON;
+                config.arrivalRate = atof(arrivals.c_str() + 8);
+                if (config.arrivalRate <= 0)
+                    usage(argv[0]);
+            }
+            else if (arrivals.compare(0, 6, "trace:") == 0)
+            {
+                config.arrivals = ARRIVAL_TRACE;
+                trace = loadTrace(arrivals.c_str() + 6);
+                if (trace.empty())
+                {
+                    fprintf(stderr, "%s: expected one arrival time per line, nondecreasing\n", arrivals.c_str() + 6);
+                    exit(1);
+                }
+            }
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--triage" && i + 1 < argc)
+        {
+            int *share = config.triageShare;
+            if (!parseTriple(argv[++i], share) || share[0] + share[1] + share[2] != 100)
+                usage(argv[0]);
+        }
+        else if (option == "--triage-weights" && i + 1 < argc)
+        {
+            int *weights = config.triageWeights;
+            if (!parseTriple(argv[++i], weights) || weights[0] < 1 || weights[1] < 1 || weights[2] < 1)
+                usage(argv[0]);
+        }
+        else if (option == "--timing" && i + 1 < argc)
+        {
+            std::string timing = argv[++i];
+
+            if (timing == "sleep")
+                config.timing = TIMING_SLEEP;
+            else if (timing == "spin")
+                config.timing = TIMING_SPIN;
+            else if (timing == "hybrid")
+                config.timing = TIMING_HYBRID;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--sync" && i + 1 < argc)
+        {
+            std::string sync = argv[++i];
+
+            if (sync == "semaphore")
+                config.sync = SYNC_SEMAPHORE;
+            else if (sync == "spin")
+                config.sync = SYNC_SPIN;
+            else
+                usage(argv[0]);
+        }
+        else if (option == "--seed" && i + 1 < argc)
+            config.seed = strtoull(argv[++i], NULL, 10);
+        else
+            usage(argv[0]);
     }
 
-    return arg;
-}
-
-// ----- Init threads
-
-pthread_t receptionist;
-
-pthread_t patients[15];
-int patientIds[15];
-
-pthread_t doctors[3];
-int doctorIds[3];
-
-pthread_t nurses[3];
-int nurseIds[3];
-
-int errcode; /* holds pthread error code */
-int *status; /* holds return code */
-
-void initSemaphores()
-{
-    /*
-        int numDoctors;
-        int numNurses;
-        int numPatients;
-
-        sem_t waitEachPatientRegister; // Each patient register in turn
-
-        int receptionistPatients = 0; // Count of patients the receptionist has received
-
-        int registerPatientId = -1;     // Current patient id that receptionist is processing
-        sem_t patientCheckIn;           // Patient just registered. Receptionist waits for a patient to checking in before register that patient with the nurse
-        sem_t receptionistRegisterDone; // Receptionist finishes registering for current patient
-        sem_t patientLeaveReceptionist; // Patient signals to receptionist that he/she leaves the receptionist. Receptionist then notices to nurse
-
-        sem_t nursePatientsProtect; // Protection for count since all nurses have access to
-        int nursePatients = 0;      // Count of patients all nurses have processed
-
-        int *nurseOfPatient;     // Array (Size = Patients) - Assigned nurse of a patient
-        sem_t *patientWaitNurse; // Array (Size = Patients) - Nurses can use this to signal each patient that it's their turn
-
-        sem_t *nurseQueueProtect;    // Array (Size = Nurses) - Protection for queue since the receptionist and nurses can work concurrently on these queues
-        std::queue<int> *nurseQueue; // Array (Size = Nurses) - Waiting room of patients for each nurse
-        sem_t *patientJoinWaitRoom;  // Array (Size = Nurses) - Each nurse takes a patient from waiting room. Patient posts when they join wait room
-
-        sem_t doctorPatientsProtect; // Protection of count since all doctors have access to
-        int doctorPatients = 0;      // Count of patients all doctors have processed
-
-        sem_t *doctorReady;   // Array (Size = Doctors) - Whether each doctor is ready or not. For nurse to send in new patient
-        int *patientOfDoctor; // Array (Size = Doctors) - Current patient of a doctor. Default to -1 meaning no patient
-
-        sem_t *patientSymptom; // Array (Size = Doctors) - Each doctor listens to patient symptom
-        sem_t *doctorAdvice;   // Array (Size = Doctors) - Each doctor gives out advice
-        sem_t *patientLeave;   // Array (Size = Doctors) - Each doctor waits for patient to leave
-    */
-
-    semInit(waitEachPatientRegister, "waitEachPatientRegister", 1);
-
-    semInit(patientCheckIn, "patientCheckIn", 0);
-    semInit(receptionistRegisterDone, "receptionistRegisterDone", 0);
-    semInit(patientLeaveReceptionist, "patientLeaveReceptionist", 0);
-
-    semInit(nursePatientsProtect, "nursePatientsProtect", 1);
-
-    for (int patientId = 0; patientId < numPatients; patientId++)
+    // Raw records would garble the report on stdout
+    if (logMode == LOG_BINARY && logPath == NULL)
     {
-        semInit(patientWaitNurse[patientId], "patientWaitNurse - patientId", 0);
+        usage(argv[0]);
     }
 
-    for (int nurseId = 0; nurseId < numNurses; nurseId++)
+    // Stealing relies on timed waits, which only the thread engine has
+    if (config.steal && config.engine != ENGINE_THREADS)
     {
-        semInit(nurseQueueProtect[nurseId], "nurseQueueProtect - nurseId", 1);
-        semInit(patientJoinWaitRoom[nurseId], "patientJoinWaitRoom - nurseId", 0);
+        usage(argv[0]);
     }
 
-    semInit(doctorPatientsProtect, "doctorPatientsProtect", 1);
-
-    for (int doctorId = 0; doctorId < numDoctors; doctorId++)
+    // Staff processes are forks of the thread engine. Each process would need a drainer of its own for events,
+    // with nothing to merge their output
+    if (config.processes && (config.engine != ENGINE_THREADS || logMode != LOG_SILENT))
     {
-        semInit(doctorReady[doctorId], "doctorReady - doctorId", 1);
-
-        semInit(patientSymptom[doctorId], "patientSymptom - doctorId", 0);
-        semInit(doctorAdvice[doctorId], "doctorAdvice - doctorId", 0);
-        semInit(patientLeave[doctorId], "patientLeave - doctorId", 0);
+        usage(argv[0]);
     }
-}
-
-void initPatients()
-{
-    int patientId;
 
-    /* Create patient threads */
-    for (patientId = 0; patientId < numPatients; patientId++)
+    // Shards are thread-engine clinics run side by side. Their events and spans would all use the same patient
+    // ids, and a stats page describes one clinic
+    if (numShards < 1 ||
+        (numShards > 1 && (config.engine != ENGINE_THREADS || config.processes || logMode != LOG_SILENT || statsPath != NULL || tracePath != NULL)))
     {
-        // Save patient id
-        patientIds[patientId] = patientId;
-
-        /* create thread */
-        errcode = pthread_create(&patients[patientId], /* thread struct             */
-                                 NULL,                 /* default thread attributes */
-                                 patientThread,        /* start routine             */
-                                 &patientIds[patientId]);
-
-        if (errcode)
-        {
-            /* arg to routine */
-            errexit(errcode, "pthread_create");
-        }
+        usage(argv[0]);
     }
-}
 
-void initReceptionist()
-{
-    /* create thread */
-    errcode = pthread_create(&receptionist,      /* thread struct             */
-                             NULL,               /* default thread attributes */
-                             receptionistThread, /* start routine             */
-                             NULL);
-
-    if (errcode)
+    // Batches only save wake-ups of nurse threads, so the other engines have nothing to batch
+    if (config.admissionBatch < 1 || config.admissionTimeout < 0 || (config.admissionBatch > 1 && config.engine != ENGINE_THREADS))
     {
-        /* arg to routine */
-        errexit(errcode, "pthread_create");
+        usage(argv[0]);
     }
-}
 
-void initNurses()
-{
-    int nurseId;
-
-    /* Create doctor threads */
-    for (nurseId = 0; nurseId < numNurses; nurseId++)
-    {
-        // Save doctor id
-        nurseIds[nurseId] = nurseId;
+    // One nurse per doctor unless told otherwise
+    if (config.numNurses == 0)
+        config.numNurses = config.numDoctors;
 
-        /* create thread */
-        errcode = pthread_create(&nurses[nurseId], /* thread struct             */
-                                 NULL,             /* default thread attributes */
-                                 nurseThread,      /* start routine             */
-                                 &nurseIds[nurseId]);
+    if (config.numWorkers == 0)
+        config.numWorkers = sysconf(_SC_NPROCESSORS_ONLN) / numShards > 1 ? sysconf(_SC_NPROCESSORS_ONLN) / numShards : 1;
 
-        if (errcode)
-        {
-            /* arg to routine */
-            errexit(errcode, "pthread_create");
-        }
+    if (config.numDoctors < 1 || config.numNurses < 1 || config.numPatients < 1 || config.numWorkers < 1 || config.numReceptionists < 1)
+    {
+        usage(argv[0]);
     }
-}
-
-void initDoctors()
-{
-    int doctorId;
 
-    /* Create doctor threads */
-    for (doctorId = 0; doctorId < numDoctors; doctorId++)
+    // Lanes of a room are rings of at most MAX_ROOM_CAPACITY
+    if (config.roomCapacity > MAX_ROOM_CAPACITY)
     {
-        // Save doctor id
-        doctorIds[doctorId] = doctorId;
-
-        /* create thread */
-        errcode = pthread_create(&doctors[doctorId], /* thread struct             */
-                                 NULL,               /* default thread attributes */
-                                 doctorThread,       /* start routine             */
-                                 &doctorIds[doctorId]);
-
-        if (errcode)
-        {
-            /* arg to routine */
-            errexit(errcode, "pthread_create");
-        }
+        usage(argv[0]);
     }
-}
 
-void exitThreads()
-{
-    for (int patientId = 0; patientId < numPatients; patientId++)
+    // A trace sets the arrivals of as many patients as it has lines
+    if (config.arrivals == ARRIVAL_TRACE)
     {
-        errcode = pthread_join(patients[patientId], (void **)&status);
-
-        if (errcode)
-        {
-            errexit(errcode, "pthread_join");
-        }
-
-        /* check thread's exit status, should be the same as the
-        thread number for this example */
-        if (*status != patientId)
+        if ((int)trace.size() < config.numPatients)
         {
-            fprintf(stderr, "thread %d terminated abnormally\n", patientId);
+            fprintf(stderr, "Trace has %zu arrivals for %d patients\n", trace.size(), config.numPatients);
             exit(1);
         }
+        config.arrivalTrace = trace.data();
     }
 
-    errcode = pthread_join(receptionist, NULL);
-    if (errcode)
-    {
-        errexit(errcode, "pthread_join");
-    }
+    Clinic *clinic = NULL;
+    ShardedClinic *sharded = NULL;
+    if (numShards > 1)
+        sharded = createShardedClinic(config, numShards, route);
+    else
+        clinic = createClinic(config);
 
-    for (int doctorId = 0; doctorId < numDoctors; doctorId++)
+    // Mapped before any staff process forks, so they all count into the same page
+    if (statsPath != NULL)
     {
-        errcode = pthread_join(doctors[doctorId], (void **)&status);
-
-        if (errcode)
-        {
-            errexit(errcode, "pthread_join");
-        }
-
-        /* check thread's exit status, should be the same as the
-        thread number for this example */
-        if (*status != doctorId)
-        {
-            fprintf(stderr, "thread %d terminated abnormally\n", doctorId);
+        clinic->stats = createStatsPage(statsPath, config.numReceptionists, config.numNurses, config.numDoctors, config.numPatients);
+        if (clinic->stats == NULL)
             exit(1);
-        }
     }
 
-    for (int nurseId = 0; nurseId < numNurses; nurseId++)
-    {
-        errcode = pthread_join(nurses[nurseId], (void **)&status);
-
-        if (errcode)
-        {
-            errexit(errcode, "pthread_join");
-        }
+    std::cout << "Run with " << config.numPatients << " patients, "
+              << config.numReceptionists << " receptionists, "
+              << config.numNurses << " nurses, "
+              << config.numDoctors << " doctors, "
+              << config.numWorkers << " workers, ";
+    if (sharded != NULL)
+        std::cout << "all per shard of " << numShards << " routed " << routeNames[route] << ", ";
+    std::cout << "engine " << engineNames[config.engine] << ", "
+              << "sync " << syncNames[config.sync] << ", "
+              << (config.processes ? "staff processes, " : "")
+              << "seed " << config.seed
+              << std::endl
+              << std::endl;
 
-        /* check thread's exit status, should be the same as the
-        thread number for this example */
-        if (*status != nurseId)
+    FILE *logOut = stdout;
+    if (logPath != NULL && logMode != LOG_SILENT)
+    {
+        logOut = fopen(logPath, logMode == LOG_BINARY ? "wb" : "w");
+        if (logOut == NULL)
         {
-            fprintf(stderr, "thread %d terminated abnormally\n", nurseId);
+            perror(logPath);
             exit(1);
         }
     }
-}
-
-// ----- Main
-
-int main(int argc, char **argv)
-{
-    // Initialization for random
-    srand(time(NULL));
-
-    /*
-        int numDoctors;
-        int numNurses;
-        int numPatients;
-
-        sem_t waitEachPatientRegister; // Each patient register in turn
-
-        int receptionistPatients = 0; // Count of patients the receptionist has received
-
-        int registerPatientId = -1;     // Current patient id that receptionist is processing
-        sem_t patientCheckIn;           // Patient just registered. Receptionist waits for a patient to checking in before register that patient with the nurse
-        sem_t receptionistRegisterDone; // Receptionist finishes registering for current patient
-        sem_t patientLeaveReceptionist; // Patient signals to receptionist that he/she leaves the receptionist. Receptionist then notices to nurse
-
-        sem_t nursePatientsProtect; // Protection for count since all nurses have access to
-        int nursePatients = 0;      // Count of patients all nurses have processed
 
-        int *nurseOfPatient;     // Array (Size = Patients) - Assigned nurse of a patient
-        sem_t *patientWaitNurse; // Array (Size = Patients) - Nurses can use this to signal each patient that it's their turn
+    logStart(logMode, logOut);
 
-        sem_t *nurseQueueProtect;    // Array (Size = Nurses) - Protection for queue since the receptionist and nurses can work concurrently on these queues
-        std::queue<int> *nurseQueue; // Array (Size = Nurses) - Waiting room of patients for each nurse
-        sem_t *patientJoinWaitRoom;  // Array (Size = Nurses) - Each nurse takes a patient from waiting room. Patient posts when they join wait room
-
-        sem_t doctorPatientsProtect; // Protection of count since all doctors have access to
-        int doctorPatients = 0;      // Count of patients all doctors have processed
+    // Before any staff process forks, so they all append to the same file
+    if (tracePath != NULL && !traceStart(tracePath))
+        exit(1);
 
-        sem_t *doctorReady;   // Array (Size = Doctors) - Whether each doctor is ready or not. For nurse to send in new patient
-        int *patientOfDoctor; // Array (Size = Doctors) - Current patient of a doctor. Default to -1 meaning no patient
+    if (sharded != NULL)
+        runShardedClinic(*sharded);
+    else
+        runClinic(*clinic);
 
-        sem_t *patientSymptom; // Array (Size = Doctors) - Each doctor listens to patient symptom
-        sem_t *doctorAdvice;   // Array (Size = Doctors) - Each doctor gives out advice
-        sem_t *patientLeave;   // Array (Size = Doctors) - Each doctor waits for patient to leave
-    */
+    if (statsPath != NULL)
+    {
+        sealStatsPage(clinic->stats);
+        unmapStatsPage(clinic->stats);
+        clinic->stats = NULL;
+    }
 
-    // Get command line inputs
-    numDoctors = stoiHandler(argv[1]);
-    numNurses = numDoctors;
-    numPatients = stoiHandler(argv[2]);
+    logStop();
+    if (logOut != stdout)
+        fclose(logOut);
 
-    nurseOfPatient = new int[numPatients];
-    patientWaitNurse = new sem_t[numPatients];
+    int actors[TRACK_COUNT] = {config.numReceptionists, config.numNurses, config.numDoctors, config.numPatients};
+    traceStop(actors);
 
-    nurseQueueProtect = new sem_t[numNurses];
-    nurseQueue = new std::queue<int>[numNurses];
-    patientJoinWaitRoom = new sem_t[numNurses];
+    printf("Simulation complete\n");
 
-    doctorReady = new sem_t[numDoctors];
-    patientOfDoctor = new int[numDoctors];
-    for (int i = 0; i < numDoctors; i++)
-        patientOfDoctor[i] = -1;
+    // Staff threads sleep while idle, so CPU time should stay well below wall time
+    timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
 
-    patientSymptom = new sem_t[numDoctors];
-    doctorAdvice = new sem_t[numDoctors];
-    patientLeave = new sem_t[numDoctors];
+    rusage usage;
+    processUsage(usage);
 
-    std::cout << "Run with " << numPatients << " patients, "
-              << numNurses << " nurses, "
-              << numDoctors << " doctors"
-              << std::endl
-              << std::endl;
+    double userTime = timevalSeconds(usage.ru_utime);
+    double sysTime = timevalSeconds(usage.ru_stime);
 
-    initSemaphores();
+    printf("Wall time %.3f s, CPU time %.3f s (user %.3f s, sys %.3f s)\n",
+           timespecSeconds(endTime) - timespecSeconds(startTime),
+           userTime + sysTime, userTime, sysTime);
 
-    initPatients();
-    initReceptionist();
-    initDoctors();
-    initNurses();
+    // Each shard is a whole clinic, so only what compares shards is reported
+    if (sharded != NULL)
+    {
+        printShardReport(sharded);
+        printSemaphoreReport();
+        destroyShardedClinic(sharded);
+        return 0;
+    }
 
-    exitThreads();
+    printRegistrationReport(clinic);
+    printAssignmentReport(clinic);
+    printOverflowReport(clinic);
+    printDoctorReport(clinic);
+    printArrivalReport(clinic);
+    printLatencyReport(clinic);
+    printTriageReport(clinic);
+    printSemaphoreReport();
+    printMemoryFootprint(clinic);
 
-    printf("Simulation complete\n");
+    destroyClinic(clinic);
 
     return 0;
-}
\ No newline at end of file
+}
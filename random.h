@@ -0,0 +1,70 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+// xoshiro256** (Blackman and Vigna): a few shifts and multiplies per draw and no shared state, so every
+// thread or actor owns one and nothing contends the way the global lock inside rand() does.
+// seed(seed, stream) splits one run seed into independent streams, one per actor or patient,
+// so what each actor draws depends only on the seed and not on how threads were scheduled.
+class Xoshiro256
+{
+public:
+    void seed(uint64_t seed, uint64_t stream)
+    {
+        // Scramble the stream id first so neighbouring streams don't start one splitmix step apart
+        uint64_t x = seed ^ splitMix(stream + 0x9E3779B97F4A7C15ULL);
+
+        for (int i = 0; i < 4; i++)
+        {
+            x += 0x9E3779B97F4A7C15ULL;
+            state[i] = splitMix(x);
+        }
+    }
+
+    uint64_t next()
+    {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+
+        return result;
+    }
+
+    // Both bounds are inclusive. Multiply-shift instead of modulo: no division, no bias worth measuring
+    int inRange(int lb, int ub)
+    {
+        uint64_t range = (uint64_t)(ub - lb) + 1;
+        return lb + (int)(((next() >> 32) * range) >> 32);
+    }
+
+    // Uniform in [0, 1) with 53 random bits
+    double uniform()
+    {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    // splitmix64 finalizer
+    static uint64_t splitMix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+    uint64_t state[4];
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "sem_stats.h"
+
+// ----- Process totals
+
+thread_local SemStatsTable semStatsTable;
+
+// Totals per kind of semaphore, from threads that have exited. Its own mutex, since a semaphore here
+// would count itself
+struct SemKind
+{
+    std::string kind;
+    SemStats stats;
+};
+
+pthread_mutex_t semKindsProtect = PTHREAD_MUTEX_INITIALIZER;
+std::vector<SemKind> semKinds;
+
+// "doctorReady - doctorId" -> "doctorReady"
+std::string semKind(const char *name)
+{
+    const char *suffix = strstr(name, " - ");
+    return suffix == NULL ? std::string(name) : std::string(name, suffix - name);
+}
+
+// Add table into the totals and clear it, so nothing is counted twice
+void semStatsFold(SemStatsTable &table)
+{
+    pthread_mutex_lock(&semKindsProtect);
+
+    for (int slot = 0; slot < SEM_STATS_SLOTS; slot++)
+    {
+        SemStats &stats = table.slots[slot];
+        if (stats.name == NULL)
+            continue;
+
+        std::string kind = semKind(stats.name);
+        size_t i = 0;
+        while (i < semKinds.size() && semKinds[i].kind != kind)
+            i++;
+
+        if (i == semKinds.size())
+        {
+            SemKind added;
+            added.kind = kind;
+            memset(&added.stats, 0, sizeof(added.stats));
+            semKinds.push_back(added);
+        }
+
+        SemStats &total = semKinds[i].stats;
+        total.waits += stats.waits;
+        total.spun += stats.spun;
+        total.blocked += stats.blocked;
+        total.posts += stats.posts;
+        total.blockedTotal += stats.blockedTotal;
+        if (stats.blockedMax > total.blockedMax)
+            total.blockedMax = stats.blockedMax;
+
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    pthread_mutex_unlock(&semKindsProtect);
+}
+
+SemStatsTable::~SemStatsTable()
+{
+    semStatsFold(*this);
+}
+
+// ----- Report
+
+bool moreBlocked(const SemKind &a, const SemKind &b)
+{
+    return a.stats.blockedTotal > b.stats.blockedTotal;
+}
+
+void printSemaphoreReport()
+{
+    // The calling thread is still alive, so its table has not been folded yet
+    semStatsFold(semStatsTable);
+
+    pthread_mutex_lock(&semKindsProtect);
+
+    std::vector<SemKind> kinds = semKinds;
+    std::sort(kinds.begin(), kinds.end(), moreBlocked);
+
+    if (!kinds.empty())
+    {
+        printf("%-24s %10s %10s %10s %8s %12s %12s %10s\n", "Semaphore", "waits", "spun", "blocked", "blocked%", "asleep ms",
+               "max us", "posts");
+
+        for (const SemKind &kind : kinds)
+        {
+            const SemStats &stats = kind.stats;
+            printf("%-24s %10llu %10llu %10llu %7.1f%% %12.3f %12.1f %10llu\n", kind.kind.c_str(),
+                   (unsigned long long)stats.waits, (unsigned long long)stats.spun, (unsigned long long)stats.blocked,
+                   stats.waits ? 100.0 * stats.blocked / stats.waits : 0.0,
+                   stats.blockedTotal * 1e3, stats.blockedMax * 1e6, (unsigned long long)stats.posts);
+        }
+    }
+
+    pthread_mutex_unlock(&semKindsProtect);
+}
@@ -0,0 +1,57 @@
+#ifndef SEM_STATS_H
+#define SEM_STATS_H
+
+#include <stdint.h>
+
+// Contention counters for the semWait / semPost helpers. Each thread counts into its own table keyed by
+// the name string the helper was given, with plain increments, and folds it into the process totals when
+// it exits. Only a wait that could not take the semaphore right away reads the clock.
+// Rows of the report group every semaphore of one kind: the name up to " - ", so "doctorReady - doctorId"
+// over all doctors is one row
+
+struct SemStats
+{
+    const char *name; // As given to the helper. NULL for a free slot
+    uint64_t waits;   // Every wait, blocked or not
+    uint64_t spun;    // Waits that found the semaphore at zero but caught a post while polling
+    uint64_t blocked; // Waits that found the semaphore at zero and had to sleep
+    uint64_t posts;
+    double blockedTotal; // Seconds asleep over all blocked waits
+    double blockedMax;   // Longest single blocked wait, in seconds
+};
+
+#define SEM_STATS_SLOTS 64 // Distinct names one thread can use. Power of two
+
+struct SemStatsTable
+{
+    SemStats slots[SEM_STATS_SLOTS];
+
+    ~SemStatsTable(); // Folds into the process totals as the thread exits
+};
+
+extern thread_local SemStatsTable semStatsTable;
+
+// This thread's counters for name. Names are string literals, so the pointer is the key
+inline SemStats &semStats(const char *name)
+{
+    unsigned slot = (unsigned)((uintptr_t)name >> 3) & (SEM_STATS_SLOTS - 1);
+
+    while (true)
+    {
+        SemStats &stats = semStatsTable.slots[slot];
+        if (stats.name == name)
+            return stats;
+        if (stats.name == NULL)
+        {
+            stats.name = name;
+            return stats;
+        }
+        slot = (slot + 1) & (SEM_STATS_SLOTS - 1);
+    }
+}
+
+// Table of every kind of semaphore by time spent blocked, once every other counting thread has exited.
+// Prints nothing when no helper was used, as in the coroutine and simulation engines
+void printSemaphoreReport();
+
+#endif
@@ -0,0 +1,183 @@
+#include <vector>
+#include <stdio.h>
+
+#include "shards.h"
+
+const char *routeNames[] = {"round-robin", "least-loaded", "two-choices"};
+
+// ----- Shards
+
+ShardedClinic *createShardedClinic(const ClinicConfig &config, int numShards, RoutePolicy route)
+{
+    ShardedClinic *sharded = new ShardedClinic();
+    sharded->config = config;
+    sharded->route = route;
+
+    readTopology(sharded->topology);
+
+    // Per-patient state is laid out up front, so room for every patient in every shard would cost K times an
+    // unsharded clinic's
+    long long share = (config.numPatients + numShards - 1) / numShards;
+    long long room = route == ROUTE_ROUND_ROBIN ? share : share * SHARD_HEADROOM;
+
+    for (int shardId = 0; shardId < numShards; shardId++)
+    {
+        // Its staff draw from a seed of their own, or every shard would replay the same service times
+        ClinicConfig shardConfig = config;
+        shardConfig.numPatients = room < config.numPatients ? room : config.numPatients;
+        shardConfig.seed = config.seed + shardId;
+
+        Clinic *shard = createClinic(shardConfig);
+        sliceTopology(sharded->topology, shardId, numShards, shard->topology);
+        shard->confined = true;
+
+        sharded->shards.push_back(shard);
+    }
+
+    return sharded;
+}
+
+void destroyShardedClinic(ShardedClinic *sharded)
+{
+    for (Clinic *shard : sharded->shards)
+        destroyClinic(shard);
+    delete sharded;
+}
+
+// ----- Front door
+
+// Shard the route policy picks for the next patient. Loads are snapshots: a shard's workers keep changing them
+// while the door reads
+int pickShard(ShardedClinic &sharded, int patientId, Xoshiro256 &random)
+{
+    const std::vector<Clinic *> &shards = sharded.shards;
+    int numShards = shards.size();
+
+    switch (sharded.route)
+    {
+    case ROUTE_ROUND_ROBIN:
+        return patientId % numShards;
+
+    case ROUTE_LEAST_LOADED:
+    {
+        // Scan from where round robin would go, so ties spread out instead of piling onto shard 0
+        int best = patientId % numShards;
+        int bestLoad = patientsWaiting(*shards[best]);
+
+        for (int i = 1; i < numShards; i++)
+        {
+            int shardId = (patientId + i) % numShards;
+            int load = patientsWaiting(*shards[shardId]);
+            if (load < bestLoad)
+            {
+                best = shardId;
+                bestLoad = load;
+            }
+        }
+        return best;
+    }
+
+    case ROUTE_TWO_CHOICES:
+    {
+        if (numShards == 1)
+            return 0;
+
+        int first = random.inRange(0, numShards - 1);
+        int second = random.inRange(0, numShards - 2);
+        if (second >= first)
+            second++;
+
+        return patientsWaiting(*shards[second]) < patientsWaiting(*shards[first]) ? second : first;
+    }
+    }
+
+    return 0;
+}
+
+// The picked shard or, once that one is full, the next round with room. The shards have room for every patient
+int routePatient(ShardedClinic &sharded, int patientId, Xoshiro256 &random)
+{
+    const std::vector<Clinic *> &shards = sharded.shards;
+    int shardId = pickShard(sharded, patientId, random);
+
+    while (shards[shardId]->patientsAdmitted == shards[shardId]->config.numPatients)
+        shardId = (shardId + 1) % shards.size();
+
+    return shardId;
+}
+
+void runShardedClinic(ShardedClinic &sharded)
+{
+    const ClinicConfig &config = sharded.config;
+
+    for (Clinic *shard : sharded.shards)
+        openClinic(*shard);
+
+    // One clock for every shard, so their latencies and run times line up
+    sharded.openedAt = monotonicSeconds();
+    for (Clinic *shard : sharded.shards)
+        shard->openedAt = sharded.openedAt;
+
+    Xoshiro256 arrivalRandom, routeRandom;
+    arrivalRandom.seed(config.seed, randomStream(STREAM_ARRIVAL, 0));
+    routeRandom.seed(config.seed, randomStream(STREAM_ROUTE, 0));
+    double arrival = 0;
+
+    // The door's timed waits count toward the lateness of the first shard
+    Clinic &door = *sharded.shards[0];
+
+    for (int patientId = 0; patientId < config.numPatients; patientId++)
+    {
+        arrival = nextArrival(config, arrivalRandom, patientId, arrival);
+        if (config.arrivals != ARRIVAL_BATCH)
+            waitUntil(door, sharded.openedAt + arrival);
+
+        int shardId = routePatient(sharded, patientId, routeRandom);
+        admitPatient(*sharded.shards[shardId], sharded.openedAt + arrival);
+    }
+
+    for (Clinic *shard : sharded.shards)
+        closeDoor(*shard);
+
+    sharded.lastPatientLeftAt = sharded.openedAt;
+    for (Clinic *shard : sharded.shards)
+    {
+        finishClinic(*shard);
+
+        if (shard->patientsAdmitted > 0 && shard->lastPatientLeftAt > sharded.lastPatientLeftAt)
+            sharded.lastPatientLeftAt = shard->lastPatientLeftAt;
+        sharded.endToEnd.merge(shard->phaseLatency[PHASE_END_TO_END]);
+    }
+}
+
+// ----- Report
+
+void printShardReport(const ShardedClinic *sharded)
+{
+    printf("Shards %zu routed %s over ", sharded->shards.size(), routeNames[sharded->route]);
+    printTopology(sharded->topology);
+
+    // Rates count patients seen, so not those turned away at a full room
+    printf("%-8s %10s %10s %8s %12s %12s %12s %12s\n", "Shard", "patients", "room", "cores", "patients/s", "e2e p50 us", "e2e p99 us", "e2e max us");
+
+    int admitted = 0, room = 0;
+    for (size_t shardId = 0; shardId < sharded->shards.size(); shardId++)
+    {
+        const Clinic *shard = sharded->shards[shardId];
+        const LatencyHistogram &endToEnd = shard->phaseLatency[PHASE_END_TO_END];
+        double runTime = shard->lastPatientLeftAt - shard->openedAt;
+        admitted += shard->patientsAdmitted;
+        room += shard->config.numPatients;
+
+        printf("%-8zu %10d %10d %8zu %12.0f %12.1f %12.1f %12.1f\n", shardId, shard->patientsAdmitted, shard->config.numPatients, shard->topology.cores.size(),
+               runTime > 0 ? endToEnd.count() / runTime : 0.0,
+               endToEnd.percentile(0.5) / 1e3, endToEnd.percentile(0.99) / 1e3, endToEnd.max() / 1e3);
+    }
+
+    double runTime = sharded->lastPatientLeftAt - sharded->openedAt;
+    const LatencyHistogram &endToEnd = sharded->endToEnd;
+
+    printf("%-8s %10d %10d %8zu %12.0f %12.1f %12.1f %12.1f\n", "all", admitted, room, sharded->topology.cores.size(),
+           runTime > 0 ? endToEnd.count() / runTime : 0.0,
+           endToEnd.percentile(0.5) / 1e3, endToEnd.percentile(0.99) / 1e3, endToEnd.max() / 1e3);
+}
@@ -0,0 +1,50 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <vector>
+
+#include "clinic.h"
+
+// K clinics behind one front door. Each shard is a whole thread-engine clinic with its own staff, workers,
+// queues and counters, confined to its own share of the cores, so shards share nothing but the door. The
+// door runs on the main thread: it paces arrivals for the whole run and sends each patient to a shard by
+// the route policy. The only thing it reads from a shard is how many patients are inside
+
+enum RoutePolicy
+{
+    ROUTE_ROUND_ROBIN,  // Shards in turn, reading nothing
+    ROUTE_LEAST_LOADED, // Shard with the fewest patients inside, reading every shard's count
+    ROUTE_TWO_CHOICES   // Fewer inside of two shards picked at random
+};
+
+extern const char *routeNames[];
+
+#define SHARD_HEADROOM 2 // Room a shard has under the load-following routes, in even shares of the patients
+
+struct ShardedClinic
+{
+    ClinicConfig config; // numPatients is the total over shards, every other count is per shard. A shard's own
+                         // config.numPatients is how many it has room for
+    RoutePolicy route;
+
+    std::vector<Clinic *> shards;
+    Topology topology; // The whole machine, split between shards
+
+    double openedAt;           // When the first patient could arrive, the same for every shard
+    double lastPatientLeftAt;  // When the last patient of any shard left
+    LatencyHistogram endToEnd; // Every shard's end to end latency, merged once all have closed
+};
+
+// One clinic per shard. Round robin gives each room for exactly its share of the patients, the other routes
+// SHARD_HEADROOM shares, and the door passes over a full shard. Threads only start in runShardedClinic
+ShardedClinic *createShardedClinic(const ClinicConfig &config, int numShards, RoutePolicy route);
+
+// Open every shard, route every patient and close them all. Call once
+void runShardedClinic(ShardedClinic &sharded);
+
+void destroyShardedClinic(ShardedClinic *sharded);
+
+// Patients, room, throughput and end to end latency of each shard and of the whole run
+void printShardReport(const ShardedClinic *sharded);
+
+#endif
@@ -0,0 +1,509 @@
+#include <cstdlib>
+#include <stdio.h>
+#include <queue>
+#include <deque>
+#include <vector>
+
+#include "clinic.h"
+#include "event_log.h"
+
+// Simulation engine: the receptionist -> nurse waiting room -> doctor flow of the thread engine as a
+// discrete-event simulation on one thread. Time is virtual: an event calendar (a heap ordered by virtual
+// time) says what happens next, and stage service times only move the clock. Each policy decision is
+// taken at the same point as in the thread engine, and statistics land in the same Clinic fields, so
+// every report reads the same, in virtual seconds
+
+// ----- Simulation state
+
+enum SimEventType
+{
+    SIM_ARRIVAL,    // Patient id enters the clinic
+    SIM_REGISTERED, // Receptionist id finished registering its patient
+    SIM_IN_OFFICE,  // Nurse id finished taking its patient to the doctor's office
+    SIM_LEAVES      // Doctor id finished advising its patient
+};
+
+struct SimEvent
+{
+    double time;
+    unsigned long long sequence; // Order of scheduling, so events at the same time stay FIFO
+    SimEventType type;
+    int id;
+};
+
+// Min-heap order for std::priority_queue: true when a happens after b
+struct SimEventLater
+{
+    bool operator()(const SimEvent &a, const SimEvent &b) const
+    {
+        if (a.time != b.time)
+            return a.time > b.time;
+        return a.sequence > b.sequence;
+    }
+};
+
+enum SimNurseState
+{
+    SIM_NURSE_IDLE,           // Room empty
+    SIM_NURSE_WAITING_DOCTOR, // Claimed the front patient, waiting for a doctor to be ready
+    SIM_NURSE_HANDING_OFF     // Taking patient to the doctor's office
+};
+
+// A nurse's waiting room: one FIFO per triage class, taken from in TriagePicker order
+struct SimRoom
+{
+    std::deque<int> queues[PRIORITY_COUNT];
+    TriagePicker triage;
+    size_t length;
+
+    void push(int patientId, int priority)
+    {
+        queues[priority].push_back(patientId);
+        length++;
+    }
+
+    // Only when someone is waiting
+    int pop()
+    {
+        bool waiting[PRIORITY_COUNT];
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+            waiting[priority] = !queues[priority].empty();
+
+        std::deque<int> &queue = queues[triage.pick(waiting)];
+        int patientId = queue.front();
+        queue.pop_front();
+        length--;
+        return patientId;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+};
+
+struct SimClinic
+{
+    Clinic *clinic;
+
+    // Event calendar. Most events are due right away, so those skip the heap for a FIFO. Ties between
+    // the two still go by sequence, so the order is exactly that of one heap
+    std::priority_queue<SimEvent, std::vector<SimEvent>, SimEventLater> calendar; // Events later than now
+    std::deque<SimEvent> due;                                                    // Events at now, in sequence order
+    unsigned long long nextSequence;
+    double now;
+
+    std::deque<int> admission;          // Patients waiting for a receptionist
+    std::deque<int> idleReceptionists;  // Receptionists waiting for a patient, longest waiting first
+    std::vector<int> receptionistPatient; // Patient each receptionist is registering
+    std::vector<double> blockedSince;     // When each receptionist started waiting for a seat for that patient
+
+    std::vector<std::deque<int>> receptionistsWaitingOn; // Receptionists waiting for a seat in each room, in order of arrival
+
+    std::vector<SimRoom> rooms; // Waiting room of each nurse
+    std::vector<SimNurseState> nurseStates;
+    std::vector<int> nursePatient; // Patient each nurse is taking to a doctor
+    std::vector<int> nurseDoctor;  // Doctor that patient goes to
+
+    std::deque<int> readyDoctors;                // Shared dispatch: doctors waiting for a patient, longest waiting first
+    std::deque<int> nursesWaiting;               // Shared dispatch: nurses waiting for any doctor, in order of claim
+    std::vector<bool> doctorReady;               // Pinned dispatch: doctor waits for its nurses' next patient
+    std::vector<std::deque<int>> nursesWaitingOn; // Pinned dispatch: nurses waiting for each doctor
+    std::vector<int> doctorPatient;              // Patient with each doctor
+
+    Xoshiro256 arrivalRandom; // STREAM_ARRIVAL, as every engine draws arrivals
+    int patientsArrived;
+    int patientsLeft;
+};
+
+// ----- Event handling
+
+void simSchedule(SimClinic &sim, double delay, SimEventType type, int id)
+{
+    SimEvent event = {sim.now + delay, sim.nextSequence++, type, id};
+
+    if (delay <= 0)
+        sim.due.push_back(event);
+    else
+        sim.calendar.push(event);
+}
+
+// Take the next event off the calendar. False once nothing is left to happen
+bool simNextEvent(SimClinic &sim, SimEvent &event)
+{
+    bool heapFirst = !sim.calendar.empty() &&
+                     (sim.due.empty() || (sim.calendar.top().time <= sim.now && sim.calendar.top().sequence < sim.due.front().sequence));
+
+    if (heapFirst)
+    {
+        event = sim.calendar.top();
+        sim.calendar.pop();
+        return true;
+    }
+
+    if (sim.due.empty())
+        return false;
+
+    event = sim.due.front();
+    sim.due.pop_front();
+    return true;
+}
+
+// endPhase on the simulation's single thread
+double simEndPhase(Clinic &clinic, int patientId, PatientPhase phase, double now)
+{
+    double elapsed = now - clinic.phaseStartedAt[patientId];
+    clinic.phaseLatency[phase].recordUnshared((uint64_t)(elapsed * 1e9));
+    if (phase == PHASE_WAITING_ROOM)
+        clinic.classWaitLatency[clinic.priorityOfPatient[patientId]].recordUnshared((uint64_t)(elapsed * 1e9));
+    traceClinic(clinic, TRACK_PATIENT, patientId, phaseNames[phase], -1, clinic.phaseStartedAt[patientId], now);
+    clinic.phaseStartedAt[patientId] = now;
+    return elapsed;
+}
+
+// Idle receptionists pick up waiting patients
+void simStartRegistrations(SimClinic &sim)
+{
+    Clinic &clinic = *sim.clinic;
+
+    while (!sim.admission.empty() && !sim.idleReceptionists.empty())
+    {
+        int patientId = sim.admission.front();
+        sim.admission.pop_front();
+        int receptionistId = sim.idleReceptionists.front();
+        sim.idleReceptionists.pop_front();
+
+        ReceptionistState &receptionist = clinic.receptionists[receptionistId];
+        simEndPhase(clinic, patientId, PHASE_RECEPTION_WAIT, sim.now);
+        if (receptionist.patients == 0)
+            receptionist.firstRegister = sim.now;
+
+        logEvent(EV_RECEPTIONIST_RECEIVES, receptionistId, patientId);
+
+        sim.receptionistPatient[receptionistId] = patientId;
+        simSchedule(sim, sampleService(clinic.config.receptionService, receptionist.random), SIM_REGISTERED, receptionistId);
+    }
+}
+
+// Seating a patient can send its nurse to a doctor, and a nurse leaving with a patient frees a seat
+void simSeatPatient(SimClinic &sim, int receptionistId, int nurseId);
+
+// Nurse takes the front patient of its room to a ready doctor
+void simAssignDoctor(SimClinic &sim, int nurseId, int doctorId)
+{
+    Clinic &clinic = *sim.clinic;
+    NurseState &nurse = clinic.nurses[nurseId];
+    DoctorState &doctor = clinic.doctors[doctorId];
+
+    int patientId = sim.rooms[nurseId].pop();
+
+    logEvent(EV_NURSE_TAKES, nurseId, patientId);
+
+    double wait = simEndPhase(clinic, patientId, PHASE_WAITING_ROOM, sim.now);
+    nurse.patientsTaken++;
+    nurse.waitTotal += wait;
+    if (wait > nurse.waitMax)
+        nurse.waitMax = wait;
+    statsTaken(clinic, nurse, nurseId);
+
+    clinic.doctorOfPatient[patientId] = doctorId;
+    sim.doctorPatient[doctorId] = patientId;
+    doctor.busySince = sim.now;
+    statsDoctor(clinic, doctor, true);
+
+    sim.nurseStates[nurseId] = SIM_NURSE_HANDING_OFF;
+    sim.nursePatient[nurseId] = patientId;
+    sim.nurseDoctor[nurseId] = doctorId;
+    simSchedule(sim, sampleService(clinic.config.nurseService, nurse.random), SIM_IN_OFFICE, nurseId);
+
+    // The seat just freed goes to the receptionist waiting longest for one in this room
+    std::deque<int> &blocked = sim.receptionistsWaitingOn[nurseId];
+    if (!blocked.empty())
+    {
+        int receptionistId = blocked.front();
+        blocked.pop_front();
+        clinic.receptionists[receptionistId].blockedTotal += sim.now - sim.blockedSince[receptionistId];
+        simSeatPatient(sim, receptionistId, nurseId);
+    }
+}
+
+// An idle nurse with a patient waiting claims it and looks for a doctor
+void simNurseLooksForDoctor(SimClinic &sim, int nurseId)
+{
+    if (sim.nurseStates[nurseId] != SIM_NURSE_IDLE || sim.rooms[nurseId].size() == 0)
+        return;
+
+    sim.nurseStates[nurseId] = SIM_NURSE_WAITING_DOCTOR;
+
+    if (sim.clinic->config.dispatchPolicy == DISPATCH_PINNED)
+    {
+        int doctorId = nurseId % sim.clinic->config.numDoctors;
+        if (sim.doctorReady[doctorId])
+        {
+            sim.doctorReady[doctorId] = false;
+            simAssignDoctor(sim, nurseId, doctorId);
+        }
+        else
+            sim.nursesWaitingOn[doctorId].push_back(nurseId);
+        return;
+    }
+
+    if (!sim.readyDoctors.empty())
+    {
+        int doctorId = sim.readyDoctors.front();
+        sim.readyDoctors.pop_front();
+        simAssignDoctor(sim, nurseId, doctorId);
+    }
+    else
+        sim.nursesWaiting.push_back(nurseId);
+}
+
+// Doctor is free for the next patient: the nurse waiting longest gets it, otherwise the doctor waits
+void simReadyDoctor(SimClinic &sim, int doctorId)
+{
+    if (sim.clinic->config.dispatchPolicy == DISPATCH_PINNED)
+    {
+        std::deque<int> &waiting = sim.nursesWaitingOn[doctorId];
+        if (waiting.empty())
+        {
+            sim.doctorReady[doctorId] = true;
+            return;
+        }
+
+        int nurseId = waiting.front();
+        waiting.pop_front();
+        simAssignDoctor(sim, nurseId, doctorId);
+        return;
+    }
+
+    if (sim.nursesWaiting.empty())
+    {
+        sim.readyDoctors.push_back(doctorId);
+        return;
+    }
+
+    int nurseId = sim.nursesWaiting.front();
+    sim.nursesWaiting.pop_front();
+    simAssignDoctor(sim, nurseId, doctorId);
+}
+
+void simArrival(SimClinic &sim, int patientId)
+{
+    Clinic &clinic = *sim.clinic;
+
+    clinic.arrivedAt[patientId] = sim.now;
+    clinic.phaseStartedAt[patientId] = sim.now;
+
+    logEvent(EV_PATIENT_ENTERS, patientId);
+
+    sim.admission.push_back(patientId);
+    sim.patientsArrived++;
+    statsAdmitted(clinic, sim.patientsArrived);
+
+    // Each arrival schedules the next, so the calendar holds one at a time
+    if (sim.patientsArrived < clinic.config.numPatients)
+    {
+        double next = nextArrival(clinic.config, sim.arrivalRandom, patientId + 1, sim.now);
+        simSchedule(sim, next - sim.now, SIM_ARRIVAL, patientId + 1);
+    }
+
+    simStartRegistrations(sim);
+}
+
+// Registration done: the receptionist's patient sits in nurseId's room and the receptionist is free
+void simSeatPatient(SimClinic &sim, int receptionistId, int nurseId)
+{
+    Clinic &clinic = *sim.clinic;
+    ReceptionistState &receptionist = clinic.receptionists[receptionistId];
+    int patientId = sim.receptionistPatient[receptionistId];
+    clinic.nurseOfPatient[patientId] = nurseId;
+
+    logEvent(EV_PATIENT_SITS, patientId);
+
+    traceClinic(clinic, TRACK_RECEPTIONIST, receptionistId, "registration", patientId, clinic.phaseStartedAt[patientId], sim.now);
+    simEndPhase(clinic, patientId, PHASE_REGISTRATION, sim.now);
+    sim.rooms[nurseId].push(patientId, clinic.priorityOfPatient[patientId]);
+
+    receptionist.patients++;
+    receptionist.lastRegister = sim.now;
+    statsSeated(clinic, receptionist, nurseId);
+    sampleRoomLengths(clinic.config, receptionist, [&](int room) { return sim.rooms[room].size(); });
+
+    sim.idleReceptionists.push_back(receptionistId);
+    simStartRegistrations(sim);
+    simNurseLooksForDoctor(sim, nurseId);
+}
+
+void simPatientLeaves(SimClinic &sim)
+{
+    sim.patientsLeft++;
+    if (sim.patientsLeft == sim.clinic->config.numPatients)
+        sim.clinic->lastPatientLeftAt = sim.now;
+}
+
+void simRegistered(SimClinic &sim, int receptionistId)
+{
+    Clinic &clinic = *sim.clinic;
+    ReceptionistState &receptionist = clinic.receptionists[receptionistId];
+    int patientId = sim.receptionistPatient[receptionistId];
+
+    int assignedNurseId = assignNurse(clinic.config, receptionist, patientId, [&](int room) { return sim.rooms[room].size(); });
+    int nurseId = findFreeSeat(clinic.config, receptionist, assignedNurseId,
+                               [&](int room) { return sim.rooms[room].size() < (size_t)clinic.config.roomCapacity; });
+
+    clinic.priorityOfPatient[patientId] = randomPriority(clinic.config, patientId);
+
+    if (nurseId != -1)
+    {
+        simSeatPatient(sim, receptionistId, nurseId);
+        return;
+    }
+
+    // No free seat to be had: the receptionist keeps the patient until the assigned room frees one
+    if (clinic.config.overflow != OVERFLOW_REJECT)
+    {
+        sim.blockedSince[receptionistId] = sim.now;
+        sim.receptionistsWaitingOn[assignedNurseId].push_back(receptionistId);
+        return;
+    }
+
+    // Room full: the patient leaves without seeing a doctor
+    clinic.nurseOfPatient[patientId] = -1;
+    logEvent(EV_PATIENT_TURNED_AWAY, patientId, assignedNurseId);
+
+    traceClinic(clinic, TRACK_RECEPTIONIST, receptionistId, "registration", patientId, clinic.phaseStartedAt[patientId], sim.now);
+    simEndPhase(clinic, patientId, PHASE_REGISTRATION, sim.now);
+    receptionist.patientsShed++;
+    simPatientLeaves(sim);
+
+    sim.idleReceptionists.push_back(receptionistId);
+    simStartRegistrations(sim);
+}
+
+void simInOffice(SimClinic &sim, int nurseId)
+{
+    Clinic &clinic = *sim.clinic;
+    int patientId = sim.nursePatient[nurseId];
+    int doctorId = sim.nurseDoctor[nurseId];
+
+    traceClinic(clinic, TRACK_NURSE, nurseId, "escort", patientId, clinic.phaseStartedAt[patientId], sim.now);
+    simEndPhase(clinic, patientId, PHASE_HANDOFF, sim.now);
+
+    logEvent(EV_PATIENT_IN_OFFICE, patientId, doctorId);
+    logEvent(EV_DOCTOR_LISTENS, doctorId, patientId);
+
+    simSchedule(sim, sampleService(clinic.config.doctorService, clinic.doctors[doctorId].random), SIM_LEAVES, doctorId);
+
+    sim.nurseStates[nurseId] = SIM_NURSE_IDLE;
+    simNurseLooksForDoctor(sim, nurseId);
+}
+
+void simLeaves(SimClinic &sim, int doctorId)
+{
+    Clinic &clinic = *sim.clinic;
+    DoctorState &doctor = clinic.doctors[doctorId];
+    int patientId = sim.doctorPatient[doctorId];
+
+    logEvent(EV_PATIENT_ADVISED, patientId, doctorId);
+    logEvent(EV_PATIENT_LEAVES, patientId);
+
+    simEndPhase(clinic, patientId, PHASE_CONSULTATION, sim.now);
+    clinic.phaseLatency[PHASE_END_TO_END].recordUnshared((uint64_t)((sim.now - clinic.arrivedAt[patientId]) * 1e9));
+    clinic.classEndToEndLatency[clinic.priorityOfPatient[patientId]].recordUnshared((uint64_t)((sim.now - clinic.arrivedAt[patientId]) * 1e9));
+
+    doctor.patientsSeen++;
+    doctor.busyTotal += sim.now - doctor.busySince;
+    statsDoctor(clinic, doctor, false);
+    traceClinic(clinic, TRACK_DOCTOR, doctorId, "consultation", patientId, doctor.busySince, sim.now);
+    sim.doctorPatient[doctorId] = -1;
+
+    simPatientLeaves(sim);
+
+    simReadyDoctor(sim, doctorId);
+}
+
+// ----- Engine
+
+void runSimulatedClinic(Clinic &clinic)
+{
+    const ClinicConfig &config = clinic.config;
+
+    SimClinic *sim = new SimClinic();
+    sim->clinic = &clinic;
+    sim->nextSequence = 0;
+    sim->now = 0;
+    sim->patientsArrived = 0;
+    sim->patientsLeft = 0;
+
+    sim->receptionistPatient.assign(config.numReceptionists, -1);
+    sim->blockedSince.assign(config.numReceptionists, 0);
+    sim->receptionistsWaitingOn.resize(config.numNurses);
+    sim->rooms.resize(config.numNurses);
+    for (SimRoom &room : sim->rooms)
+    {
+        room.length = 0;
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+        {
+            room.triage.weights[priority] = config.triageWeights[priority];
+            room.triage.credit[priority] = 0;
+        }
+    }
+    sim->nurseStates.assign(config.numNurses, SIM_NURSE_IDLE);
+    sim->nursePatient.assign(config.numNurses, -1);
+    sim->nurseDoctor.assign(config.numNurses, -1);
+    sim->doctorReady.assign(config.numDoctors, false);
+    sim->nursesWaitingOn.resize(config.numDoctors);
+    sim->doctorPatient.assign(config.numDoctors, -1);
+
+    clinic.openedAt = 0;
+
+    for (int receptionistId = 0; receptionistId < config.numReceptionists; receptionistId++)
+    {
+        clinic.receptionists[receptionistId].id = receptionistId;
+        sim->idleReceptionists.push_back(receptionistId);
+    }
+
+    for (int nurseId = 0; nurseId < config.numNurses; nurseId++)
+        clinic.nurses[nurseId].id = nurseId;
+
+    // Every doctor starts out ready
+    for (int doctorId = 0; doctorId < config.numDoctors; doctorId++)
+    {
+        clinic.doctors[doctorId].id = doctorId;
+        clinic.doctors[doctorId].patientId = -1;
+        simReadyDoctor(*sim, doctorId);
+    }
+
+    sim->arrivalRandom.seed(config.seed, randomStream(STREAM_ARRIVAL, 0));
+    simSchedule(*sim, nextArrival(config, sim->arrivalRandom, 0, 0), SIM_ARRIVAL, 0);
+
+    SimEvent event;
+    while (simNextEvent(*sim, event))
+    {
+        sim->now = event.time;
+
+        switch (event.type)
+        {
+        case SIM_ARRIVAL:
+            simArrival(*sim, event.id);
+            break;
+        case SIM_REGISTERED:
+            simRegistered(*sim, event.id);
+            break;
+        case SIM_IN_OFFICE:
+            simInOffice(*sim, event.id);
+            break;
+        case SIM_LEAVES:
+            simLeaves(*sim, event.id);
+            break;
+        }
+    }
+
+    if (sim->patientsLeft != config.numPatients)
+    {
+        fprintf(stderr, "Simulation stalled with %d of %d patients seen\n", sim->patientsLeft, config.numPatients);
+        exit(1);
+    }
+
+    delete sim;
+}
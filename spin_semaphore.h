@@ -0,0 +1,142 @@
+#ifndef SPIN_SEMAPHORE_H
+#define SPIN_SEMAPHORE_H
+
+#include <semaphore.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+
+// A sem_t that can poll for a post for a while before parking in the kernel. Most handoffs in the clinic
+// are posted within microseconds, and a waiter that catches the post while still running saves the futex
+// sleep on its side and the futex wake on the poster's.
+// The polling budget adapts per semaphore. A wait that got its post while polling moves the budget an eighth
+// of the way toward twice the polls it needed. A wait that parked and was woken soon after grows it by a
+// quarter, since polling would have been cheaper. A wait that parked for long halves it, so a semaphore
+// whose posts come late soon stops burning CPU on polls. The budget stays within SPIN_MIN_POLLS and
+// SPIN_MAX_POLLS. With spinning off it is a plain sem_t.
+// On a single CPU the poster cannot run while the waiter polls, so every poll is wasted and every park
+// looks short. Spinning is turned off there
+
+#define SPIN_MIN_POLLS 16
+#define SPIN_MAX_POLLS 16384
+#define SPIN_WORTHWHILE 20e-6 // A park shorter than this, in seconds, would have been cheaper as polls
+
+// One pause of a spin loop: lets the sibling hyperthread run and keeps the core from speculating ahead
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+class SpinSemaphore
+{
+public:
+    // Same results as sem_init. A shared semaphore must live in memory every process using it has mapped
+    int init(unsigned value, bool spinning, bool shared)
+    {
+        spin = spinning && sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        pollLimit.store(SPIN_MIN_POLLS * 4, std::memory_order_relaxed);
+        return sem_init(&sem, shared, value);
+    }
+
+    void destroy()
+    {
+        sem_destroy(&sem);
+    }
+
+    bool spins() const
+    {
+        return spin;
+    }
+
+    // Same results as sem_trywait
+    int tryWait()
+    {
+        return sem_trywait(&sem);
+    }
+
+    // Poll for a post within the budget. True when it took one
+    bool spinWait()
+    {
+        int limit = pollLimit.load(std::memory_order_relaxed);
+
+        for (int polls = 1; polls <= limit; polls++)
+        {
+            cpuRelax();
+
+            int value;
+            sem_getvalue(&sem, &value);
+            if (value > 0 && sem_trywait(&sem) == 0)
+            {
+                adapt(limit + (2 * polls - limit) / 8);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Sleep in the kernel until a post. Same results as sem_wait
+    int park()
+    {
+        return sem_wait(&sem);
+    }
+
+    // Tell the budget how long a wait that went to park slept
+    void parked(double seconds)
+    {
+        int limit = pollLimit.load(std::memory_order_relaxed);
+        adapt(seconds < SPIN_WORTHWHILE ? limit + limit / 4 : limit / 2);
+    }
+
+    // try, spin, park, for callers that keep no statistics
+    void wait()
+    {
+        if (sem_trywait(&sem) == 0)
+            return;
+        if (spin && spinWait())
+            return;
+
+        timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (sem_wait(&sem) == -1 && errno == EINTR)
+            ;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (spin)
+            parked((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+
+    // Same results as sem_timedwait, deadline on CLOCK_REALTIME. Never spins: its callers are already polling
+    int timedWait(const timespec &deadline)
+    {
+        return sem_timedwait(&sem, &deadline);
+    }
+
+    // Same results as sem_post
+    int post()
+    {
+        return sem_post(&sem);
+    }
+
+private:
+    // Concurrent waiters may overwrite each other's update. The budget is only a hint, so that is fine
+    void adapt(int limit)
+    {
+        if (limit < SPIN_MIN_POLLS)
+            limit = SPIN_MIN_POLLS;
+        if (limit > SPIN_MAX_POLLS)
+            limit = SPIN_MAX_POLLS;
+        pollLimit.store(limit, std::memory_order_relaxed);
+    }
+
+    sem_t sem;
+    bool spin;
+    std::atomic<int> pollLimit; // Polls the next wait may spend before parking
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread.
+// Storage is handed in by the owner (the clinic arena), capacity must be a power of two.
+// Each side keeps a cached copy of the other side's index, so the shared index is only
+// re-read when the ring looks full (producer) or empty (consumer).
+template <typename T>
+class SpscRing
+{
+public:
+    static size_t storageBytes(unsigned capacity)
+    {
+        return sizeof(T) * capacity;
+    }
+
+    void init(T *storage, unsigned capacity)
+    {
+        buffer = storage;
+        mask = capacity - 1;
+
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        cachedHead = 0;
+        cachedTail = 0;
+    }
+
+    unsigned capacity() const
+    {
+        return mask + 1;
+    }
+
+    // Producer only. False when the ring is full
+    bool push(const T &item)
+    {
+        unsigned currentTail = tail.load(std::memory_order_relaxed);
+
+        if (currentTail - cachedHead > mask)
+        {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (currentTail - cachedHead > mask)
+                return false;
+        }
+
+        buffer[currentTail & mask] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. False when the ring is empty
+    bool pop(T &item)
+    {
+        unsigned currentHead = head.load(std::memory_order_relaxed);
+
+        if (currentHead == cachedTail)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (currentHead == cachedTail)
+                return false;
+        }
+
+        item = buffer[currentHead & mask];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Copies the oldest item without removing it, false when the ring is empty
+    bool peek(T &item)
+    {
+        unsigned currentHead = head.load(std::memory_order_relaxed);
+
+        if (currentHead == cachedTail)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (currentHead == cachedTail)
+                return false;
+        }
+
+        item = buffer[currentHead & mask];
+        return true;
+    }
+
+    // Snapshot of the number of queued items, safe from any thread
+    unsigned size() const
+    {
+        // Consumer index first: it never passes the producer index read after it
+        unsigned popped = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - popped;
+    }
+
+private:
+    // Read-only after init, shared by both sides
+    T *buffer;
+    unsigned mask;
+
+    // Consumer side
+    alignas(64) std::atomic<unsigned> head;
+    unsigned cachedTail;
+
+    // Producer side
+    alignas(64) std::atomic<unsigned> tail;
+    unsigned cachedHead;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include <cstring>
+#include <stdio.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats_page.h"
+
+// ----- Stats page
+
+double statsClock()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+StatsHeader *createStatsPage(const char *path, int numReceptionists, int numNurses, int numDoctors, int numPatients)
+{
+    size_t size = statsPageSize(numReceptionists, numNurses, numDoctors);
+
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) == -1)
+    {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    // A fresh file reads as zeros, which is every counter at zero. The header goes in last, so a reader
+    // that finds the magic finds the sizes too
+    StatsHeader *page = (StatsHeader *)base;
+    page->version = STATS_VERSION;
+    page->pid = getpid();
+    page->numReceptionists = numReceptionists;
+    page->numNurses = numNurses;
+    page->numDoctors = numDoctors;
+    page->numPatients = numPatients;
+    page->createdAt = statsClock();
+    page->state.store(STATS_OPEN, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    page->magic = STATS_MAGIC;
+
+    return page;
+}
+
+StatsHeader *openStatsPage(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) == -1 || (size_t)status.st_size < sizeof(StatsHeader))
+    {
+        fprintf(stderr, "%s: not a clinic stats page\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    StatsHeader *page = (StatsHeader *)base;
+    bool valid = page->magic == STATS_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    valid = valid && page->version == STATS_VERSION &&
+            (size_t)status.st_size >= statsPageSize(page->numReceptionists, page->numNurses, page->numDoctors);
+
+    if (!valid)
+    {
+        fprintf(stderr, "%s: not a clinic stats page of version %d\n", path, STATS_VERSION);
+        munmap(base, status.st_size);
+        return NULL;
+    }
+
+    return page;
+}
+
+void sealStatsPage(StatsHeader *page)
+{
+    page->closedAt = statsClock();
+    page->state.store(STATS_CLOSED, std::memory_order_release);
+}
+
+void unmapStatsPage(StatsHeader *page)
+{
+    munmap(page, statsPageSize(page->numReceptionists, page->numNurses, page->numDoctors));
+}
@@ -0,0 +1,95 @@
+#ifndef STATS_PAGE_H
+#define STATS_PAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Live counters a running clinic publishes in a file that clinicstat maps, so a long run can be watched
+// while it goes. The clinic only ever does relaxed stores and adds here: no lock, no system call. Each
+// counter has one writer except where noted, and sits on a cache line apart from other writers' counters.
+// A reader sees every counter whole but not all at the same instant, which is enough for rates over a
+// sampling interval.
+// Layout: the header, then one StatsReceptionist per receptionist, one StatsNurse per nurse and one
+// StatsDoctor per doctor
+
+#define STATS_LINE 64 // Slots are padded to a cache line so two writers never share one
+#define STATS_MAGIC 0x544154534E494C43ULL // "CLINSTAT" as bytes on a little-endian machine
+#define STATS_VERSION 1
+
+enum StatsState
+{
+    STATS_OPEN,  // The clinic is running
+    STATS_CLOSED // Every patient has left. The counters are final
+};
+
+struct alignas(STATS_LINE) StatsHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    int32_t pid;
+    int32_t numReceptionists;
+    int32_t numNurses;
+    int32_t numDoctors;
+    int32_t numPatients;
+    double createdAt; // CLOCK_MONOTONIC seconds, which every process on the machine shares
+    double closedAt;  // Once state is STATS_CLOSED
+
+    std::atomic<int32_t> state;     // StatsState
+    std::atomic<uint64_t> admitted; // Patients let in so far, by the front door
+};
+
+struct alignas(STATS_LINE) StatsReceptionist
+{
+    std::atomic<uint64_t> registered; // Patients this receptionist registered
+};
+
+struct StatsNurse
+{
+    alignas(STATS_LINE) std::atomic<uint64_t> seated; // Patients put in this nurse's room, by any receptionist
+    alignas(STATS_LINE) std::atomic<uint64_t> called; // Patients taken out of this room, by this nurse or one stealing from it
+    std::atomic<uint64_t> taken;                      // Patients this nurse took to a doctor
+};
+
+struct alignas(STATS_LINE) StatsDoctor
+{
+    std::atomic<uint64_t> seen; // Patients this doctor advised
+    std::atomic<int32_t> busy;  // 1 from a patient being sent in until the patient leaves
+};
+
+inline StatsReceptionist *statsReceptionists(StatsHeader *page)
+{
+    return (StatsReceptionist *)(page + 1);
+}
+
+inline StatsNurse *statsNurses(StatsHeader *page)
+{
+    return (StatsNurse *)(statsReceptionists(page) + page->numReceptionists);
+}
+
+inline StatsDoctor *statsDoctors(StatsHeader *page)
+{
+    return (StatsDoctor *)(statsNurses(page) + page->numNurses);
+}
+
+inline size_t statsPageSize(int numReceptionists, int numNurses, int numDoctors)
+{
+    return sizeof(StatsHeader) + numReceptionists * sizeof(StatsReceptionist) + numNurses * sizeof(StatsNurse) +
+           numDoctors * sizeof(StatsDoctor);
+}
+
+// CLOCK_MONOTONIC in seconds, the clock of createdAt and closedAt
+double statsClock();
+
+// Create or truncate path and map a zeroed page for a clinic of that size, state STATS_OPEN. NULL on failure
+StatsHeader *createStatsPage(const char *path, int numReceptionists, int numNurses, int numDoctors, int numPatients);
+
+// Map the page at path to read. NULL, with the reason on stderr, when it is missing or not a stats page
+StatsHeader *openStatsPage(const char *path);
+
+// Mark the counters final, for a clinic that has closed. The file stays for a last read
+void sealStatsPage(StatsHeader *page);
+
+void unmapStatsPage(StatsHeader *page);
+
+#endif
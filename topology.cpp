@@ -0,0 +1,170 @@
+#include <cstring>
+#include <cstdlib>
+#include <sched.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "topology.h"
+
+// ----- /sys
+
+// First integer in path, or fallback when the file is missing or holds none
+int readSysInt(const char *path, int fallback)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return fallback;
+
+    int value;
+    if (fscanf(file, "%d", &value) != 1)
+        value = fallback;
+
+    fclose(file);
+    return value;
+}
+
+// The cpuN directory links its node as a "nodeM" entry. 0 when there is none, as without NUMA support
+int nodeOfCpu(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+
+    int node = 0;
+    while (dirent *entry = readdir(dir))
+    {
+        if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+        {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+
+    closedir(dir);
+    return node;
+}
+
+// ----- Topology
+
+struct CpuPlace
+{
+    int node;
+    int package;
+    int core; // core_id, only unique within a package
+    int cpu;
+};
+
+bool placeBefore(const CpuPlace &a, const CpuPlace &b)
+{
+    if (a.node != b.node)
+        return a.node < b.node;
+    if (a.package != b.package)
+        return a.package < b.package;
+    if (a.core != b.core)
+        return a.core < b.core;
+    return a.cpu < b.cpu;
+}
+
+void readTopology(Topology &topology)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        CPU_SET(0, &allowed);
+
+    std::vector<CpuPlace> places;
+    char path[96];
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        CpuPlace place;
+        place.cpu = cpu;
+        place.node = nodeOfCpu(cpu);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        place.package = readSysInt(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        place.core = readSysInt(path, cpu);
+
+        places.push_back(place);
+    }
+
+    std::sort(places.begin(), places.end(), placeBefore);
+
+    topology.cores.clear();
+    topology.nodeOfCore.clear();
+    topology.nodes = 0;
+
+    // Sorted, so siblings of a core and cores of a node are next to each other. Nodes are renumbered
+    // densely, as a process limited to some CPUs may see node 1 without node 0
+    int lastNode = -1;
+    for (size_t i = 0; i < places.size(); i++)
+    {
+        const CpuPlace &place = places[i];
+        bool sameCore = i > 0 && place.node == places[i - 1].node && place.package == places[i - 1].package &&
+                        place.core == places[i - 1].core;
+
+        if (!sameCore)
+        {
+            if (place.node != lastNode)
+            {
+                lastNode = place.node;
+                topology.nodes++;
+            }
+            topology.cores.push_back(std::vector<int>());
+            topology.nodeOfCore.push_back(topology.nodes - 1);
+        }
+
+        topology.cores.back().push_back(place.cpu);
+    }
+}
+
+void sliceTopology(const Topology &whole, int slice, int slices, Topology &part)
+{
+    int numCores = whole.cores.size();
+    int first = numCores * slice / slices;
+    int end = numCores * (slice + 1) / slices;
+    if (slices > numCores)
+    {
+        first = slice % numCores;
+        end = first + 1;
+    }
+
+    part.cores.clear();
+    part.nodeOfCore.clear();
+    part.nodes = 0;
+
+    int lastNode = -1;
+    for (int core = first; core < end; core++)
+    {
+        if (whole.nodeOfCore[core] != lastNode)
+        {
+            lastNode = whole.nodeOfCore[core];
+            part.nodes++;
+        }
+        part.cores.push_back(whole.cores[core]);
+        part.nodeOfCore.push_back(part.nodes - 1);
+    }
+}
+
+int Topology::cpuCount() const
+{
+    int count = 0;
+    for (const std::vector<int> &core : cores)
+        count += core.size();
+    return count;
+}
+
+void printTopology(const Topology &topology)
+{
+    printf("%d CPUs, %zu cores, %d node%s\n", topology.cpuCount(), topology.cores.size(), topology.nodes,
+           topology.nodes == 1 ? "" : "s");
+}
@@ -0,0 +1,28 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <vector>
+
+// Which CPUs share a core, and which cores share a NUMA node, from /sys. Only CPUs this process may run
+// on count, so a container limited to a few CPUs sees just those. Anything /sys does not say falls back
+// to one core per CPU on a single node
+
+struct Topology
+{
+    std::vector<std::vector<int>> cores; // CPU ids of each core, hyperthread siblings together. Cores ordered by node
+    std::vector<int> nodeOfCore;         // NUMA node index of each core, 0 to nodes - 1
+    int nodes;                           // Count of NUMA nodes with at least one allowed CPU
+
+    int cpuCount() const;
+};
+
+void readTopology(Topology &topology);
+
+// Share slice of slices of whole: a run of whole cores, renumbering the nodes it covers. With more slices
+// than cores, slices take one core each and wrap around
+void sliceTopology(const Topology &whole, int slice, int slices, Topology &part);
+
+// "8 CPUs, 4 cores, 1 node" and a newline to stdout
+void printTopology(const Topology &topology);
+
+#endif
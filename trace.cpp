@@ -0,0 +1,261 @@
+#include <cstring>
+#include <cstdlib>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TRACE_LINE_MAX 160 // Longest JSON line one span formats to, with room to spare
+
+static const char *trackNames[TRACK_COUNT] = {"Receptionists", "Nurses", "Doctors", "Patients"};
+static const char *actorNames[TRACK_COUNT] = {"Receptionist", "Nurse", "Doctor", "Patient"};
+
+bool tracing = false;
+
+static int traceFd = -1; // The JSON file
+static int spansFd = -1; // Scratch file of raw spans, unlinked, formatted into the JSON by traceStop
+
+// ----- Formatting
+
+// Only traceStop formats, once the clinic is done, but at millions of spans snprintf parsing its format for
+// every field still costs more than the run. These only append
+
+static char *putString(char *out, const char *text)
+{
+    while (*text != '\0')
+        *out++ = *text++;
+    return out;
+}
+
+// The fixed parts of a line, with their length known at compile time
+template <size_t N>
+static char *putLiteral(char *out, const char (&text)[N])
+{
+    memcpy(out, text, N - 1);
+    return out + N - 1;
+}
+
+static char *putUnsigned(char *out, uint64_t value)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    while (count > 0)
+        *out++ = digits[--count];
+    return out;
+}
+
+// Nanoseconds as the microseconds trace events count in, to the nanosecond
+static char *putMicros(char *out, uint64_t nanoseconds)
+{
+    out = putUnsigned(out, nanoseconds / 1000);
+    unsigned fraction = nanoseconds % 1000;
+    *out++ = '.';
+    *out++ = '0' + fraction / 100;
+    *out++ = '0' + fraction / 10 % 10;
+    *out++ = '0' + fraction % 10;
+    return out;
+}
+
+// Spans go in with one append per buffer, which the kernel never interleaves with another process's or thread's
+static void writeAll(int fd, const void *data, size_t length)
+{
+    const char *bytes = (const char *)data;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, bytes, length);
+        if (written <= 0)
+        {
+            perror("trace write");
+            return;
+        }
+        bytes += written;
+        length -= written;
+    }
+}
+
+// ----- Per-thread buffers
+
+struct TraceSpan
+{
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+    int32_t track;
+    int32_t actor;
+    int32_t patientId;
+};
+
+struct TraceBuffer
+{
+    TraceSpan spans[TRACE_BUFFER_SPANS];
+    int count;
+};
+
+// Raw, as they are. Names stay valid in the process that formats them: staff processes are forks of it
+static void flushBuffer(TraceBuffer &buffer)
+{
+    writeAll(spansFd, buffer.spans, buffer.count * sizeof(TraceSpan));
+    buffer.count = 0;
+}
+
+// One JSON line per span into text, which has room for TRACE_LINE_MAX per span. Returns the end
+static char *formatSpans(char *text, const TraceSpan *spans, int count)
+{
+    char *out = text;
+
+    for (int i = 0; i < count; i++)
+    {
+        const TraceSpan &span = spans[i];
+
+        out = putLiteral(out, "{\"name\":\"");
+        out = putString(out, span.name);
+        out = putLiteral(out, "\",\"ph\":\"X\",\"pid\":");
+        *out++ = '1' + span.track;
+        out = putLiteral(out, ",\"tid\":");
+        out = putUnsigned(out, span.actor);
+        out = putLiteral(out, ",\"ts\":");
+        out = putMicros(out, span.start);
+        out = putLiteral(out, ",\"dur\":");
+        out = putMicros(out, span.duration);
+        if (span.patientId >= 0)
+        {
+            out = putLiteral(out, ",\"args\":{\"patient\":");
+            out = putUnsigned(out, span.patientId);
+            *out++ = '}';
+        }
+        out = putLiteral(out, "},\n");
+    }
+
+    return out;
+}
+
+// Allocated on a thread's first span, written out as the thread exits
+struct TraceHolder
+{
+    TraceBuffer *buffer;
+
+    ~TraceHolder()
+    {
+        if (buffer == NULL)
+            return;
+        if (tracing)
+            flushBuffer(*buffer);
+        delete buffer;
+    }
+};
+
+static thread_local TraceHolder traceHolder;
+
+void traceAppend(TraceTrack track, int actor, const char *name, int patientId, uint64_t start, uint64_t duration)
+{
+    TraceBuffer *buffer = traceHolder.buffer;
+    if (buffer == NULL)
+    {
+        buffer = new TraceBuffer;
+        buffer->count = 0;
+        traceHolder.buffer = buffer;
+    }
+
+    TraceSpan &span = buffer->spans[buffer->count++];
+    span.name = name;
+    span.start = start;
+    span.duration = duration;
+    span.track = track;
+    span.actor = actor;
+    span.patientId = patientId;
+
+    if (buffer->count == TRACE_BUFFER_SPANS)
+        flushBuffer(*buffer);
+}
+
+// ----- Trace file
+
+bool traceStart(const char *path)
+{
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (traceFd == -1)
+    {
+        perror(path);
+        return false;
+    }
+
+    // Next to nothing else, so it may be on a tmpfs, but out of the way of the JSON
+    const char *directory = getenv("TMPDIR");
+    char scratch[4096];
+    snprintf(scratch, sizeof(scratch), "%s/clinic-trace-XXXXXX", directory != NULL ? directory : "/tmp");
+
+    spansFd = mkstemp(scratch);
+    if (spansFd == -1)
+    {
+        perror(scratch);
+        close(traceFd);
+        traceFd = -1;
+        return false;
+    }
+    unlink(scratch);
+    fcntl(spansFd, F_SETFL, O_APPEND);
+
+    tracing = true;
+    return true;
+}
+
+void traceStop(const int actors[TRACK_COUNT])
+{
+    if (!tracing)
+        return;
+
+    if (traceHolder.buffer != NULL)
+        flushBuffer(*traceHolder.buffer);
+    tracing = false;
+
+    const char *header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    writeAll(traceFd, header, strlen(header));
+
+    // Every span, a buffer's worth at a time
+    TraceSpan *spans = new TraceSpan[TRACE_BUFFER_SPANS];
+    char *text = new char[TRACE_BUFFER_SPANS * TRACE_LINE_MAX];
+
+    lseek(spansFd, 0, SEEK_SET);
+    ssize_t bytes;
+    while ((bytes = read(spansFd, spans, TRACE_BUFFER_SPANS * sizeof(TraceSpan))) > 0)
+    {
+        // The file only holds whole spans, and a read of it only comes up short at its end
+        int count = bytes / sizeof(TraceSpan);
+        writeAll(traceFd, text, formatSpans(text, spans, count) - text);
+    }
+
+    delete[] text;
+    delete[] spans;
+    close(spansFd);
+    spansFd = -1;
+
+    // Names for the viewer's tracks. Patients keep bare ids: there can be millions of them
+    char line[TRACE_LINE_MAX];
+    for (int track = 0; track < TRACK_COUNT; track++)
+    {
+        int length = snprintf(line, sizeof(line), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                              track + 1, trackNames[track]);
+        writeAll(traceFd, line, length);
+
+        for (int actor = 0; track != TRACK_PATIENT && actor < actors[track]; actor++)
+        {
+            length = snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}},\n",
+                              track + 1, actor, actorNames[track], actor);
+            writeAll(traceFd, line, length);
+        }
+    }
+
+    // Every line so far ends in a comma, and JSON allows none after the last element
+    const char *footer = "{\"name\":\"trace_end\",\"ph\":\"M\",\"pid\":0}\n]}\n";
+    writeAll(traceFd, footer, strlen(footer));
+
+    close(traceFd);
+    traceFd = -1;
+}
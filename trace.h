@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Opt-in timeline of who did what when, as Chrome trace-event JSON that chrome://tracing and Perfetto
+// both open. Every span is a complete event on the track of one actor: a receptionist, a nurse, a doctor
+// or a patient. Each thread collects spans in a buffer of its own and, once it fills, appends the raw
+// spans to a scratch file with a single write, so no thread waits on another and the run pays one system
+// call per TRACE_BUFFER_SPANS spans. Formatting them as JSON waits for traceStop, after the run. Spans
+// land in the file out of time order; viewers sort them
+
+#define TRACE_BUFFER_SPANS 1024
+
+// One process per kind of actor in the viewer, with one thread per actor
+enum TraceTrack
+{
+    TRACK_RECEPTIONIST,
+    TRACK_NURSE,
+    TRACK_DOCTOR,
+    TRACK_PATIENT,
+    TRACK_COUNT
+};
+
+extern bool tracing;
+
+// Open path and start taking spans. False, with the reason on stderr, when it cannot be written.
+// Staff processes forked after this append to the same file
+bool traceStart(const char *path);
+
+// Record a span of actor that starts start nanoseconds into the trace and lasts duration. name must
+// outlive the trace, as a string literal does. patientId is shown on staff spans, -1 for none.
+// Only while tracing: callers check first, so a run without a trace pays one test per span
+void traceAppend(TraceTrack track, int actor, const char *name, int patientId, uint64_t start, uint64_t duration);
+
+// Write out the calling thread's spans, format every span into the file, name the tracks of actors[track]
+// actors each, and close it. Call once every other tracing thread has exited, which writes out its spans
+// as it goes
+void traceStop(const int actors[TRACK_COUNT]);
+
+#endif